@@ -2,831 +2,4395 @@
 // Created by ShiYang Jia on 25-9-20.
 //
 #include "./jsonrepair.hpp"
-#include "./utf8.h"
+#include "./utf8/unchecked.h"
 #include <algorithm>
-#include <functional>
-#include <unordered_map>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <string_view>
+#include <type_traits>
 #include <vector>
+#if __has_include(<unistd.h>)
+#include <cerrno>
+#include <unistd.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) &&        \
+    !defined(JSONREPAIR_NO_SIMD)
+#define JSONREPAIR_X86_SIMD 1
+#include <immintrin.h>
+#endif
 
-using CharT = char16_t;
-using StringT = std::u16string;
+// The repair engine below is a template over the code unit type of the
+// document: `char` for UTF-8, `char16_t` for UTF-16 and `char32_t` for
+// UTF-32; `char8_t` text goes through the `char` engine. The classification
+// helpers take code units widened to char32_t so they serve all three; UTF-8
+// bytes >= 0x80 never compare equal to any of the ASCII characters tested
+// here.
+// Characters that may span several code units (smart quotes and special
+// whitespace) are matched in place by the `...At` helpers further down.
 
-static bool isHex(CharT c) {
-  return (c >= '0' && c <= '9') || (c >= 'A' && c <= 'F') ||
-         (c >= 'a' && c <= 'f');
+// Classes of ASCII characters, looked up in one table built at compile time.
+// Code units above ASCII belong to none of them.
+struct CharClass {
+  static constexpr uint16_t Hex = 1 << 0;
+  static constexpr uint16_t Digit = 1 << 1;
+  static constexpr uint16_t Delimiter = 1 << 2;
+  static constexpr uint16_t FunctionNameStart = 1 << 3;
+  static constexpr uint16_t FunctionName = 1 << 4;
+  static constexpr uint16_t UrlChar = 1 << 5;
+  static constexpr uint16_t UnquotedStringDelimiter = 1 << 6;
+  static constexpr uint16_t StartOfValue = 1 << 7;
+  static constexpr uint16_t ControlCharacter = 1 << 8;
+  static constexpr uint16_t Whitespace = 1 << 9;
+  static constexpr uint16_t WhitespaceExceptNewline = 1 << 10;
+  static constexpr uint16_t EscapeCharacter = 1 << 11; // after a backslash
+  static constexpr uint16_t Printable = 1 << 12;       // '!' to '~'
+};
+
+struct CharTable {
+  uint16_t classes[128];
+  // JSON escape sequence of the control characters that have a short one.
+  const char *controlEscapes[0x20];
+};
+
+static constexpr void addClass(CharTable &table, const char *chars,
+                               uint16_t classes) {
+  for (; *chars != '\0'; chars++) {
+    table.classes[static_cast<unsigned char>(*chars)] |= classes;
+  }
+}
+
+static constexpr CharTable makeCharTable() {
+  CharTable table{};
+  const char *letters = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+  const char *digits = "0123456789";
+  addClass(table, digits,
+           CharClass::Hex | CharClass::Digit | CharClass::FunctionName |
+               CharClass::UrlChar | CharClass::StartOfValue);
+  addClass(table, "abcdefABCDEF", CharClass::Hex);
+  addClass(table, letters,
+           CharClass::FunctionNameStart | CharClass::FunctionName |
+               CharClass::UrlChar | CharClass::StartOfValue);
+  addClass(table, "_$",
+           CharClass::FunctionNameStart | CharClass::FunctionName |
+               CharClass::StartOfValue);
+  addClass(table, ",:[]/{}()\n+", CharClass::Delimiter);
+  addClass(table, ",[]/{}\n+", CharClass::UnquotedStringDelimiter);
+  addClass(table, "-._~:/?#@!$&'()*+,;=", CharClass::UrlChar);
+  addClass(table, "\"'{[-", CharClass::StartOfValue);
+  addClass(table, "\n\r\t\b\f", CharClass::ControlCharacter);
+  addClass(table, " \n\t\r", CharClass::Whitespace);
+  addClass(table, " \t\r", CharClass::WhitespaceExceptNewline);
+  addClass(table, "\"\\/bfnrt", CharClass::EscapeCharacter);
+  for (unsigned c = '!'; c <= '~'; c++)
+    table.classes[c] |= CharClass::Printable;
+  table.controlEscapes['\b'] = "\\b";
+  table.controlEscapes['\f'] = "\\f";
+  table.controlEscapes['\n'] = "\\n";
+  table.controlEscapes['\r'] = "\\r";
+  table.controlEscapes['\t'] = "\\t";
+  return table;
+}
+
+static constexpr CharTable charTable = makeCharTable();
+
+static bool hasClass(char32_t c, uint16_t classes) {
+  return c < 128 && (charTable.classes[c] & classes) != 0;
 }
 
-static bool isDigit(CharT c) { return c >= '0' && c <= '9'; }
+static bool isHex(char32_t c) { return hasClass(c, CharClass::Hex); }
 
-static bool isValidStringCharacter(CharT c) { return c >= 0x20; }
+static bool isDigit(char32_t c) { return hasClass(c, CharClass::Digit); }
 
-static bool isDelimiter(CharT c) {
-  return c == ',' || c == ':' || c == '[' || c == ']' || c == '/' || c == '{' ||
-         c == '}' || c == '(' || c == ')' || c == '\n' || c == '+';
+static bool isValidStringCharacter(char32_t c) { return c >= 0x20; }
+
+static bool isDelimiter(char32_t c) {
+  return hasClass(c, CharClass::Delimiter);
 }
 
-static bool isFunctionNameCharStart(CharT c) {
-  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' ||
-         c == '$';
+static bool isFunctionNameCharStart(char32_t c) {
+  return hasClass(c, CharClass::FunctionNameStart);
 }
 
-static bool isFunctionNameChar(CharT c) {
-  return isFunctionNameCharStart(c) || (c >= '0' && c <= '9');
+static bool isFunctionNameChar(char32_t c) {
+  return hasClass(c, CharClass::FunctionName);
 }
 
-static bool isUrlStart(const StringT &s) {
-  if (s.length() < 3)
+template <typename Iterator>
+static bool isUrlStart(Iterator first, Iterator last) {
+  size_t available = static_cast<size_t>(last - first);
+  if (available < 3)
     return false;
-  static const std::vector<StringT> prefixes = {
-      u"http://", u"https://", u"ftp://", u"mailto:",
-      u"file://", u"data:",    u"irc://"};
-  for (const auto &prefix : prefixes) {
-    if (s.length() >= prefix.length() &&
-        s.substr(0, prefix.length()) == prefix) {
+  static const char *const prefixes[] = {"http://", "https://", "ftp://",
+                                         "mailto:", "file://",  "data:",
+                                         "irc://"};
+  for (const char *prefix : prefixes) {
+    size_t length = std::strlen(prefix);
+    if (available >= length && std::equal(prefix, prefix + length, first)) {
       return true;
     }
   }
   return false;
 }
 
-static bool isUrlChar(CharT c) {
-  return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') ||
-         (c >= '0' && c <= '9') || c == '-' || c == '.' || c == '_' ||
-         c == '~' || c == ':' || c == '/' || c == '?' || c == '#' || c == '@' ||
-         c == '!' || c == '$' || c == '&' || c == '\'' || c == '(' ||
-         c == ')' || c == '*' || c == '+' || c == ',' || c == ';' || c == '=';
+static bool isUrlChar(char32_t c) { return hasClass(c, CharClass::UrlChar); }
+
+static bool isUnquotedStringDelimiter(char32_t c) {
+  return hasClass(c, CharClass::UnquotedStringDelimiter);
 }
 
-static bool isUnquotedStringDelimiter(CharT c) {
-  return c == ',' || c == '[' || c == ']' || c == '/' || c == '{' || c == '}' ||
-         c == '\n' || c == '+';
+static bool isStartOfValue(char32_t c) {
+  return hasClass(c, CharClass::StartOfValue);
 }
 
-static bool isStartOfValue(CharT c) {
-  return c == '"' || c == '\'' || c == '{' || c == '[' || c == '-' ||
-         (c >= '0' && c <= '9') || isFunctionNameCharStart(c);
+static bool isControlCharacter(char32_t c) {
+  return hasClass(c, CharClass::ControlCharacter);
 }
 
-static bool isControlCharacter(CharT c) {
-  return c == '\n' || c == '\r' || c == '\t' || c == '\b' || c == '\f';
+static bool isWhitespace(char32_t c) {
+  return hasClass(c, CharClass::Whitespace);
 }
 
-static bool isWhitespace(CharT c) {
-  return c == ' ' || c == '\n' || c == '\t' || c == '\r';
+static bool isWhitespaceExceptNewline(char32_t c) {
+  return hasClass(c, CharClass::WhitespaceExceptNewline);
 }
 
-static bool isWhitespaceExceptNewline(CharT c) {
-  return c == ' ' || c == '\t' || c == '\r';
+static bool isEscapeCharacter(char32_t c) {
+  return hasClass(c, CharClass::EscapeCharacter);
 }
 
-static bool isSpecialWhitespace(CharT c) {
-  unsigned char uc = static_cast<unsigned char>(c);
-  return uc == 0xA0 || (uc >= 0x2000 && uc <= 0x200A) || uc == 0x202F ||
-         uc == 0x205F || uc == 0x3000;
+static bool isSpecialWhitespace(char32_t c) {
+  return c == 0xA0 || (c >= 0x2000 && c <= 0x200A) || c == 0x202F ||
+         c == 0x205F || c == 0x3000;
 }
 
-static bool isDoubleQuote(char16_t c) {
+static bool isDoubleQuote(char32_t c) {
   return c == u'"' || c == u'“' || c == u'”';
 }
 
-static bool isSingleQuote(CharT c) {
+static bool isSingleQuote(char32_t c) {
   return c == u'\'' || c == u'`' || c == u'‘' || c == u'’';
 }
 
-static bool isQuote(char16_t c) { return isDoubleQuote(c) || isSingleQuote(c); }
+// Per-encoding matchers, selected at compile time by the width of the code
+// unit: UTF-8 for char, UTF-16 for char16_t and UTF-32 for char32_t. The
+// `...At` functions return the number of code units taken by the character
+// starting at text[i], or 0 when it does not match; the caller guarantees
+// i < text.length().
+template <typename CharT, size_t Width = sizeof(CharT)> struct Encoding;
 
-static StringT stripLastOccurrence(const StringT &text, const StringT &toStrip,
-                                   bool stripRemaining = false) {
-  auto pos = text.rfind(toStrip);
-  if (pos == StringT::npos)
-    return text;
-  if (stripRemaining) {
-    return text.substr(0, pos);
-  } else {
-    return text.substr(0, pos) + text.substr(pos + toStrip.length());
+template <typename CharT> struct Encoding<CharT, 1> {
+  using StringT = std::basic_string_view<CharT>;
+
+  static unsigned byte(const StringT &text, size_t i) {
+    return i < text.length() ? static_cast<unsigned char>(text[i]) : 0;
   }
-}
 
-static StringT insertBeforeLastWhitespace(const StringT &text,
-                                          const StringT &toInsert) {
-  if (text.empty())
-    return toInsert;
+  // Matches the three byte sequence E2 80 <last> at text[i].
+  static bool matchE280(const StringT &text, size_t i, unsigned last) {
+    return byte(text, i) == 0xE2 && byte(text, i + 1) == 0x80 &&
+           byte(text, i + 2) == last;
+  }
 
-  size_t index = text.length();
-  if (index == 0 || !isWhitespace(text[index - 1])) {
-    return text + toInsert;
+  // Where the character before text[i] starts, past its continuation
+  // bytes.
+  static size_t previous(const StringT &text, size_t i) {
+    do {
+      i--;
+    } while (i > 0 && (byte(text, i) & 0xC0) == 0x80);
+    return i;
   }
 
-  while (index > 0 && isWhitespace(text[index - 1])) {
-    index--;
+  static size_t doubleQuoteAt(const StringT &text, size_t i) {
+    if (text[i] == '"')
+      return 1;
+    // U+201C “ and U+201D ”
+    return matchE280(text, i, 0x9C) || matchE280(text, i, 0x9D) ? 3 : 0;
   }
 
-  return text.substr(0, index) + toInsert + text.substr(index);
-}
+  static size_t singleQuoteAt(const StringT &text, size_t i) {
+    if (text[i] == '\'' || text[i] == '`')
+      return 1;
+    // U+2018 ‘ and U+2019 ’
+    return matchE280(text, i, 0x98) || matchE280(text, i, 0x99) ? 3 : 0;
+  }
 
-static StringT removeAtIndex(const StringT &text, size_t start, size_t count) {
-  if (start >= text.length())
-    return text;
-  size_t end = std::min(start + count, text.length());
-  return text.substr(0, start) + text.substr(end);
-}
+  static size_t specialWhitespaceAt(const StringT &text, size_t i) {
+    unsigned b0 = byte(text, i);
+    if (b0 == 0xC2)
+      return byte(text, i + 1) == 0xA0 ? 2 : 0; // U+00A0
+    if (b0 == 0xE2) {
+      unsigned b1 = byte(text, i + 1), b2 = byte(text, i + 2);
+      if (b1 == 0x80 && ((b2 >= 0x80 && b2 <= 0x8A) || b2 == 0xAF))
+        return 3; // U+2000 - U+200A, U+202F
+      if (b1 == 0x81 && b2 == 0x9F)
+        return 3; // U+205F
+      return 0;
+    }
+    if (b0 == 0xE3)
+      return byte(text, i + 1) == 0x80 && byte(text, i + 2) == 0x80 ? 3 : 0;
+    return 0;
+  }
 
-static bool endsWithCommaOrNewline(const StringT &text) {
-  if (text.empty())
-    return false;
-  for (int i = static_cast<int>(text.length()) - 1; i >= 0; --i) {
-    CharT c = text[i];
-    if (c == ',' || c == '\n')
-      return true;
-    if (!isWhitespace(c))
-      break;
+  // Encodes the character starting at text[i] as UTF-8, for error messages.
+  static std::string characterAt(const StringT &text, size_t i) {
+    auto it = text.begin() + i;
+    utf8::internal::utf_error err =
+        utf8::internal::validate_next(it, text.end());
+    if (err != utf8::internal::UTF8_OK)
+      it = text.begin() + i + 1;
+    return std::string(text.begin() + i, it);
   }
-  return false;
-}
+};
 
-// Escape character map
-static const std::unordered_map<char16_t, char16_t> escapeCharacters = {
-    {u'"', u'"'},  {u'\\', u'\\'}, {u'/', u'/'},  {u'b', u'\b'},
-    {u'f', u'\f'}, {u'n', u'\n'},  {u'r', u'\r'}, {u't', u'\t'}};
+// UTF-16 and UTF-32: every character the engine looks for is a single unit.
+template <typename CharT> struct SingleUnitEncoding {
+  using StringT = std::basic_string_view<CharT>;
 
-static const std::unordered_map<char16_t, StringT> controlCharacters = {
-    {u'\b', u"\\b"},
-    {u'\f', u"\\f"},
-    {u'\n', u"\\n"},
-    {u'\r', u"\\r"},
-    {u'\t', u"\\t"}};
+  static size_t doubleQuoteAt(const StringT &text, size_t i) {
+    return isDoubleQuote(text[i]) ? 1 : 0;
+  }
 
-// --- JSONRepairError Implementation ---
-JSONRepairError::JSONRepairError(const std::string &message, size_t pos)
-    : std::runtime_error(message + " at position " + std::to_string(pos)),
-      position(pos) {}
+  static size_t singleQuoteAt(const StringT &text, size_t i) {
+    return isSingleQuote(text[i]) ? 1 : 0;
+  }
+
+  static size_t specialWhitespaceAt(const StringT &text, size_t i) {
+    return isSpecialWhitespace(text[i]) ? 1 : 0;
+  }
+};
 
-// --- Main jsonrepair function ---
-std::string jsonrepair(const std::string &text_utf8, int maxDepth) {
-  std::u16string input;
-  utf8::utf8to16(text_utf8.begin(), text_utf8.end(), std::back_inserter(input));
-  auto output = jsonrepair(input, maxDepth);
+// Encodes a code point as UTF-8 for an error message; surrogates and values
+// beyond U+10FFFF become U+FFFD.
+static std::string encodeCharacter(char32_t cp) {
+  if ((cp >= 0xD800 && cp <= 0xDFFF) || cp > 0x10FFFF)
+    cp = 0xFFFD;
   std::string rs;
-  utf8::utf16to8(output.begin(), output.end(), std::back_inserter(rs));
+  utf8::unchecked::append(cp, std::back_inserter(rs));
   return rs;
 }
-std::u16string jsonrepair(const std::u16string &text, int maxDepth) {
-  size_t i = 0;
-  StringT output;
-  int currentDepth = 0;
 
-  if (maxDepth <= 0)
-    maxDepth = 100;
+template <typename CharT>
+struct Encoding<CharT, 2> : SingleUnitEncoding<CharT> {
+  static size_t previous(std::basic_string_view<CharT> text, size_t i) {
+    i--;
+    if (i > 0 && text[i] >= 0xDC00 && text[i] <= 0xDFFF &&
+        text[i - 1] >= 0xD800 && text[i - 1] <= 0xDBFF)
+      i--;
+    return i;
+  }
 
-  // Helper lambdas
-  auto parseWhitespaceAndSkipComments = [&](bool skipNewline = true) -> bool {
-    size_t start = i;
-    auto isWhiteSpace = skipNewline ? isWhitespace : isWhitespaceExceptNewline;
+  // A surrogate pair is one character; a lone surrogate is none.
+  static std::string characterAt(std::basic_string_view<CharT> text,
+                                 size_t i) {
+    char32_t lead = text[i];
+    if (lead >= 0xD800 && lead <= 0xDBFF && i + 1 < text.length() &&
+        text[i + 1] >= 0xDC00 && text[i + 1] <= 0xDFFF) {
+      return encodeCharacter(0x10000 + ((lead - 0xD800) << 10) +
+                             (text[i + 1] - 0xDC00));
+    }
+    return encodeCharacter(lead);
+  }
+};
 
-    auto parseWhitespace = [&]() -> bool {
-      StringT whitespace;
-      while (i < text.length()) {
-        CharT c = text[i];
-        if (isWhiteSpace(c)) {
-          whitespace += c;
-          i++;
-        } else if (isSpecialWhitespace(c)) {
-          whitespace += ' ';
-          i++;
-        } else {
-          break;
-        }
-      }
-      if (!whitespace.empty()) {
-        output += whitespace;
-        return true;
-      }
-      return false;
-    };
+template <typename CharT>
+struct Encoding<CharT, 4> : SingleUnitEncoding<CharT> {
+  static size_t previous(std::basic_string_view<CharT>, size_t i) {
+    return i - 1;
+  }
 
-    auto parseComment = [&]() -> bool {
-      if (i + 1 < text.length() && text[i] == '/' && text[i + 1] == '*') {
-        i += 2;
-        while (i < text.length() && !(i + 1 < text.length() && text[i] == '*' &&
-                                      text[i + 1] == '/')) {
-          i++;
-        }
-        if (i + 1 < text.length())
-          i += 2;
-        return true;
-      }
-      if (i + 1 < text.length() && text[i] == '/' && text[i + 1] == '/') {
-        while (i < text.length() && text[i] != '\n') {
-          i++;
-        }
-        return true;
-      }
-      return false;
-    };
+  static std::string characterAt(std::basic_string_view<CharT> text,
+                                 size_t i) {
+    return encodeCharacter(text[i]);
+  }
+};
 
-    bool changed = parseWhitespace();
-    do {
-      bool commentChanged = parseComment();
-      if (commentChanged) {
-        changed = true;
-        parseWhitespace();
-      } else {
-        break;
-      }
-    } while (true);
+template <typename StringT>
+static size_t quoteAt(const StringT &text, size_t i) {
+  using Enc = Encoding<typename StringT::value_type>;
+  size_t length = Enc::doubleQuoteAt(text, i);
+  return length ? length : Enc::singleQuoteAt(text, i);
+}
 
-    return i > start;
-  };
+// Remembers the last forward search for a terminator. No terminator lies in
+// [from, found), so a later search starting in that range ends at `found`
+// without rescanning. parseString looks ahead past comments after every
+// quote, and this keeps repeated lookaheads into one long comment linear.
+struct SearchMemo {
+  size_t from = 1;
+  size_t found = 0;
 
-  auto parseCharacter = [&](CharT c) -> bool {
-    if (i < text.length() && text[i] == c) {
-      output += c;
+  template <typename IsTerminator>
+  size_t find(size_t i, size_t end, IsTerminator isTerminatorAt) {
+    if (i >= from && i <= found)
+      return found;
+    from = i;
+    while (i < end && !isTerminatorAt(i)) {
       i++;
-      return true;
     }
-    return false;
-  };
+    found = i;
+    return i;
+  }
+};
 
-  auto skipCharacter = [&](CharT c) -> bool {
-    if (i < text.length() && text[i] == c) {
-      i++;
-      return true;
-    }
-    return false;
-  };
+static int countTrailingZeros(uint64_t mask) {
+#if defined(__GNUC__)
+  return __builtin_ctzll(mask);
+#else
+  int count = 0;
+  while ((mask & 1) == 0) {
+    mask >>= 1;
+    count++;
+  }
+  return count;
+#endif
+}
 
-  auto skipEscapeCharacter = [&]() -> bool { return skipCharacter('\\'); };
+// Classes of code units the scanning loops stop at. A scan asks for the next
+// unit in any of a set of classes and then looks at it with the ordinary
+// predicates, so a class only has to cover every unit that may end the scan.
+struct UnitClass {
+  static constexpr unsigned Quote = 1 << 0; // " ' ` and smart quote starts
+  static constexpr unsigned Backslash = 1 << 1;
+  static constexpr unsigned Control = 1 << 2; // below 0x20, newline included
+  static constexpr unsigned Delimiter = 1 << 3; // , [ ] / { } +
+  static constexpr unsigned Colon = 1 << 4;
+  static constexpr int count = 5;
+};
 
-  auto skipEllipsis = [&]() -> bool {
-    parseWhitespaceAndSkipComments();
-    if (i + 2 < text.length() && text[i] == '.' && text[i + 1] == '.' &&
-        text[i + 2] == '.') {
-      i += 3;
-      parseWhitespaceAndSkipComments();
-      skipCharacter(',');
-      return true;
-    }
-    return false;
-  };
+template <typename CharT> static unsigned classOf(CharT c) {
+  char32_t u = static_cast<std::make_unsigned_t<CharT>>(c);
+  if (u < 0x20)
+    return UnitClass::Control;
+  switch (u) {
+  case '"':
+  case '\'':
+  case '`':
+    return UnitClass::Quote;
+  case '\\':
+    return UnitClass::Backslash;
+  case ',':
+  case '[':
+  case ']':
+  case '/':
+  case '{':
+  case '}':
+  case '+':
+    return UnitClass::Delimiter;
+  case ':':
+    return UnitClass::Colon;
+  }
+  if constexpr (sizeof(CharT) == 1) {
+    return u == 0xE2 ? UnitClass::Quote : 0u; // U+2018 - U+201D start E2 80
+  } else {
+    return isDoubleQuote(u) || isSingleQuote(u) ? UnitClass::Quote : 0u;
+  }
+}
 
-  auto parseMarkdownCodeBlock =
-      [&](const std::vector<StringT> &blocks) -> bool {
-    parseWhitespaceAndSkipComments();
-    for (const auto &block : blocks) {
-      if (i + block.length() <= text.length() &&
-          text.substr(i, block.length()) == block) {
-        i += block.length();
-        if (i < text.length() && isFunctionNameCharStart(text[i])) {
-          while (i < text.length() && isFunctionNameChar(text[i])) {
-            i++;
-          }
-        }
-        parseWhitespaceAndSkipComments();
-        return true;
-      }
-    }
-    return false;
-  };
+// Fills masks[k] with the bytes of a 64 byte block in class 1 << k.
+using ClassifyBlock = void (*)(const unsigned char *block, uint64_t *masks);
 
-  auto prevNonWhitespaceIndex = [&](size_t start) -> size_t {
-    size_t prev = start;
-    while (prev > 0 && isWhitespace(text[prev - 1])) {
-      prev--;
+#if !defined(JSONREPAIR_X86_SIMD) || !defined(__SSE2__)
+static void classifyBlockScalar(const unsigned char *block, uint64_t *masks) {
+  std::fill(masks, masks + UnitClass::count, 0);
+  for (int b = 0; b < 64; b++) {
+    unsigned classes = classOf(static_cast<char>(block[b]));
+    for (int k = 0; k < UnitClass::count; k++) {
+      if (classes & (1u << k))
+        masks[k] |= uint64_t(1) << b;
     }
-    return prev;
-  };
+  }
+}
+#endif
 
-  // Forward declarations
-  std::function<bool()> parseValue;
-  std::function<bool()> parseObject;
-  std::function<bool()> parseArray;
-  std::function<void()> parseNewlineDelimitedJSON;
-  std::function<bool(bool, size_t)> parseString;
-  std::function<bool()> parseConcatenatedString;
-  std::function<bool()> parseNumber;
-  std::function<bool()> parseKeywords;
-  std::function<bool(const StringT &, const StringT &)> parseKeyword;
-  std::function<bool(bool)> parseUnquotedString;
-  std::function<bool()> parseRegex;
-
-  // --- Implementations ---
-
-  parseValue = [&]() -> bool {
-    if (currentDepth > maxDepth) {
-      throw JSONRepairError("Maximum depth exceeded", i);
+#if defined(JSONREPAIR_X86_SIMD) && defined(__SSE2__)
+static void classifyBlockSse2(const unsigned char *block, uint64_t *masks) {
+  std::fill(masks, masks + UnitClass::count, 0);
+  for (int part = 0; part < 4; part++) {
+    __m128i v =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(block + 16 * part));
+    // [ ] and { } differ from each other only in bit 0x20.
+    __m128i folded = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    __m128i classes[UnitClass::count] = {
+        _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+                         _mm_cmpeq_epi8(v, _mm_set1_epi8('\''))),
+            _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('`')),
+                         _mm_cmpeq_epi8(v, _mm_set1_epi8('\xE2')))),
+        _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')),
+        _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(0x1F)), v),
+        _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(',')),
+                         _mm_cmpeq_epi8(v, _mm_set1_epi8('/'))),
+            _mm_or_si128(
+                _mm_cmpeq_epi8(v, _mm_set1_epi8('+')),
+                _mm_or_si128(_mm_cmpeq_epi8(folded, _mm_set1_epi8('{')),
+                             _mm_cmpeq_epi8(folded, _mm_set1_epi8('}'))))),
+        _mm_cmpeq_epi8(v, _mm_set1_epi8(':')),
+    };
+    for (int k = 0; k < UnitClass::count; k++) {
+      uint64_t bits = static_cast<uint16_t>(_mm_movemask_epi8(classes[k]));
+      masks[k] |= bits << (16 * part);
     }
-    parseWhitespaceAndSkipComments();
-    bool processed = parseObject() || parseArray() ||
-                     parseString(false, static_cast<size_t>(-1)) ||
-                     parseNumber() || parseKeywords() ||
-                     parseUnquotedString(false) || parseRegex();
-    parseWhitespaceAndSkipComments();
-    return processed;
-  };
-
-  parseObject = [&]() -> bool {
-    if (i >= text.length() || text[i] != '{')
-      return false;
-    currentDepth++;
-    output += '{';
-    i++;
-    parseWhitespaceAndSkipComments();
+  }
+}
+#endif
 
-    if (skipCharacter(',')) {
-      parseWhitespaceAndSkipComments();
+#if defined(JSONREPAIR_X86_SIMD)
+__attribute__((target("avx2"))) static void
+classifyBlockAvx2(const unsigned char *block, uint64_t *masks) {
+  std::fill(masks, masks + UnitClass::count, 0);
+  for (int part = 0; part < 2; part++) {
+    __m256i v = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(block + 32 * part));
+    __m256i folded = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+    __m256i classes[UnitClass::count] = {
+        _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')),
+                            _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\''))),
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('`')),
+                            _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\xE2')))),
+        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')),
+        _mm256_cmpeq_epi8(_mm256_min_epu8(v, _mm256_set1_epi8(0x1F)), v),
+        _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(',')),
+                            _mm256_cmpeq_epi8(v, _mm256_set1_epi8('/'))),
+            _mm256_or_si256(
+                _mm256_cmpeq_epi8(v, _mm256_set1_epi8('+')),
+                _mm256_or_si256(
+                    _mm256_cmpeq_epi8(folded, _mm256_set1_epi8('{')),
+                    _mm256_cmpeq_epi8(folded, _mm256_set1_epi8('}'))))),
+        _mm256_cmpeq_epi8(v, _mm256_set1_epi8(':')),
+    };
+    for (int k = 0; k < UnitClass::count; k++) {
+      uint64_t bits = static_cast<uint32_t>(_mm256_movemask_epi8(classes[k]));
+      masks[k] |= bits << (32 * part);
     }
+  }
+}
+#endif
 
-    bool initial = true;
-    while (i < text.length() && text[i] != '}') {
-      bool processedComma = false;
-      if (!initial) {
-        processedComma = parseCharacter(',');
-        if (!processedComma) {
-          output = insertBeforeLastWhitespace(output, u",");
-        }
-        parseWhitespaceAndSkipComments();
-      } else {
-        initial = false;
-      }
-
-      skipEllipsis();
+// Picks the widest classifier the CPU supports, once.
+static ClassifyBlock blockClassifier() {
+  static const ClassifyBlock classify = [] {
+#if defined(JSONREPAIR_X86_SIMD)
+    if (__builtin_cpu_supports("avx2"))
+      return classifyBlockAvx2;
+#endif
+#if defined(JSONREPAIR_X86_SIMD) && defined(__SSE2__)
+    return classifyBlockSse2;
+#else
+    return classifyBlockScalar;
+#endif
+  }();
+  return classify;
+}
 
-      bool processedKey = parseString(false, static_cast<size_t>(-1)) ||
-                          parseUnquotedString(true);
-      if (!processedKey) {
-        if (i >= text.length() || text[i] == '}' || text[i] == '{' ||
-            text[i] == ']' || text[i] == '[') {
-          output = stripLastOccurrence(output, u",");
-        } else {
-          throw JSONRepairError("Object key expected", i);
-        }
-        break;
-      }
+// Finds the next code unit of some classes. UTF-8 text is classified a 64
+// byte block at a time and the masks of the current block are kept, so a
+// scan jumps from one candidate to the next instead of testing every byte.
+// Wider code units are tested one at a time.
+template <typename CharT> class StructuralIndex {
+public:
+  StructuralIndex(const CharT *text, size_t length) : s(text), n(length) {}
 
-      parseWhitespaceAndSkipComments();
-      bool processedColon = parseCharacter(':');
-      bool truncated = i >= text.length();
-      if (!processedColon) {
-        if (isStartOfValue(i < text.length() ? text[i] : '\0') || truncated) {
-          output = insertBeforeLastWhitespace(output, u":");
-        } else {
-          throw JSONRepairError("Colon expected", i);
+  // Index of the first unit at or after `i` in one of `classes`, or the
+  // length of the text when there is none.
+  size_t next(size_t i, unsigned classes) {
+    if constexpr (sizeof(CharT) == 1) {
+      while (i < n) {
+        size_t start = i & ~size_t(63);
+        if (start != blockStart)
+          load(start);
+        uint64_t mask = 0;
+        for (int k = 0; k < UnitClass::count; k++) {
+          if (classes & (1u << k))
+            mask |= masks[k];
         }
+        mask >>= i - start;
+        if (mask != 0)
+          return i + countTrailingZeros(mask);
+        i = start + 64;
       }
-
-      bool processedValue = parseValue();
-      if (!processedValue) {
-        if (processedColon || truncated) {
-          output += u"null";
-        } else {
-          throw JSONRepairError("Colon expected", i);
-        }
+      return n;
+    } else {
+      while (i < n && !(classOf(s[i]) & classes)) {
+        i++;
       }
+      return i;
     }
+  }
 
-    if (i < text.length() && text[i] == '}') {
-      output += '}';
-      i++;
-    } else {
-      output = insertBeforeLastWhitespace(output, u"}");
+private:
+  const CharT *s;
+  size_t n;
+  size_t blockStart = size_t(-1);
+  uint64_t masks[UnitClass::count] = {};
+
+  void load(size_t start) {
+    const unsigned char *block =
+        reinterpret_cast<const unsigned char *>(s) + start;
+    unsigned char padded[64];
+    if (n - start < 64) {
+      // Spaces belong to no class, so the padding is never a candidate.
+      std::memset(padded, ' ', sizeof(padded));
+      std::memcpy(padded, block, n - start);
+      block = padded;
     }
-    currentDepth--;
-    return true;
-  };
+    blockClassifier()(block, masks);
+    blockStart = start;
+  }
+};
 
-  parseArray = [&]() -> bool {
-    if (i >= text.length() || text[i] != '[')
-      return false;
-    currentDepth++;
-    output += '[';
-    i++;
-    parseWhitespaceAndSkipComments();
+// Output under construction. Repairs only ever edit the last few characters
+// (a comma or colon inserted before trailing whitespace, a dangling comma or
+// quote stripped), so every edit works in place and costs time proportional
+// to its distance from the end instead of a copy of the whole output.
+template <typename CharT, typename Alloc = std::allocator<CharT>>
+class OutputBuffer {
+public:
+  using StringT = std::basic_string<CharT, std::char_traits<CharT>, Alloc>;
+  static constexpr bool discards = false;
 
-    if (skipCharacter(',')) {
-      parseWhitespaceAndSkipComments();
+  // Writes into `storage`, emptied first, keeping its capacity.
+  explicit OutputBuffer(StringT &&storage) : buffer(std::move(storage)) {
+    buffer.clear();
+  }
+
+  size_t length() const { return buffer.length(); }
+  void reserve(size_t capacity) { buffer.reserve(capacity); }
+  void follow(std::basic_string_view<CharT>, const size_t &) {}
+  // The parser calls this before each value, where no repair reaches back
+  // past the last character other than whitespace; see SinkOutput.
+  bool settle() { return true; }
+  // Whether part of the output has left for good; see SinkOutput.
+  bool sent() const { return false; }
+  // The parser calls this where a value starts at `position`, with `frames`
+  // open and `depth` containers, in a document after the first of a
+  // sequence or not, when a longer text would be repaired the same way up to
+  // there; see ResumedOutput.
+  template <typename Frames>
+  void valueStart(size_t, const Frames &, int, bool) {}
+  const StringT &str() const { return buffer; }
+  StringT take() { return std::move(buffer); }
+
+  OutputBuffer &operator+=(CharT c) {
+    buffer += c;
+    return *this;
+  }
+
+  // Appends an ASCII literal, widened to the code unit type one unit at a
+  // time: appending a range of another character type would go through a
+  // temporary string.
+  OutputBuffer &operator+=(const char *ascii) {
+    for (; *ascii != '\0'; ascii++) {
+      buffer += CharT(*ascii);
     }
+    return *this;
+  }
 
-    bool initial = true;
-    while (i < text.length() && text[i] != ']') {
-      if (!initial) {
-        bool processedComma = parseCharacter(',');
-        if (!processedComma) {
-          output = insertBeforeLastWhitespace(output, u",");
-        }
-      } else {
-        initial = false;
-      }
+  void insert(size_t pos, CharT c) { buffer.insert(pos, 1, c); }
 
-      skipEllipsis();
+  void append(std::basic_string_view<CharT> s, size_t pos, size_t count) {
+    buffer.append(s.data() + pos, count);
+  }
 
-      bool processedValue = parseValue();
-      if (!processedValue) {
-        output = stripLastOccurrence(output, u",");
-        break;
-      }
+  void truncate(size_t length) { buffer.resize(length); }
+
+  void prepend(const char *ascii) { insertAt(0, ascii); }
+
+  void insertBeforeLastWhitespace(const char *ascii) {
+    size_t index = buffer.length();
+    while (index > 0 && isWhitespace(buffer[index - 1])) {
+      index--;
     }
+    insertAt(index, ascii);
+  }
 
-    if (i < text.length() && text[i] == ']') {
-      output += ']';
-      i++;
+  void stripLastOccurrence(CharT toStrip, bool stripRemaining = false) {
+    auto pos = buffer.rfind(toStrip);
+    if (pos == StringT::npos)
+      return;
+    if (stripRemaining) {
+      buffer.resize(pos);
     } else {
-      output = insertBeforeLastWhitespace(output, u"]");
+      buffer.erase(pos, 1);
     }
-    currentDepth--;
-    return true;
-  };
+  }
 
-  parseNewlineDelimitedJSON = [&]() {
-    output = u"[\n" + output;
-    bool first = true;
-    while (i < text.length()) {
-      parseWhitespaceAndSkipComments();
-      if (i >= text.length() || !isStartOfValue(text[i]))
-        break;
-      if (!first) {
-        output += u",\n";
-      } else {
-        first = false;
-      }
-      if (!parseValue())
-        break;
+  void removeAtIndex(size_t start, size_t count) {
+    if (start >= buffer.length())
+      return;
+    buffer.erase(start, std::min(count, buffer.length() - start));
+  }
+
+  // Same as calling removeAtIndex(pos, 1) for each of the strictly
+  // ascending offsets, last one first, but in a single pass.
+  template <typename Positions>
+  void removeAtIndices(const Positions &positions) {
+    size_t count = 0;
+    while (count < positions.size() && positions[count] < buffer.length()) {
+      count++;
     }
-    output += u"\n]";
-  };
+    if (count == 0)
+      return;
+    size_t to = positions[0];
+    for (size_t k = 0; k < count; k++) {
+      size_t from = positions[k] + 1;
+      size_t end = k + 1 < count ? positions[k + 1] : buffer.length();
+      std::copy(buffer.begin() + from, buffer.begin() + end,
+                buffer.begin() + to);
+      to += end - from;
+    }
+    buffer.resize(to);
+  }
 
-  parseString = [&](bool stopAtDelimiter, size_t stopAtIndex) -> bool {
-    bool skipEscapeChars = (i < text.length() && text[i] == '\\');
-    if (skipEscapeChars) {
-      i++;
+  // Removes a comma that only whitespace follows.
+  void stripTrailingComma() {
+    for (size_t i = buffer.length(); i > 0; --i) {
+      CharT c = buffer[i - 1];
+      if (c == ',') {
+        buffer.erase(i - 1, 1);
+        return;
+      }
+      if (!isWhitespace(c))
+        return;
     }
+  }
 
-    if (i >= text.length() || !isQuote(text[i])) {
-      return false;
+  bool endsWithCommaOrNewline() const {
+    for (size_t i = buffer.length(); i > 0; --i) {
+      CharT c = buffer[i - 1];
+      if (c == ',' || c == '\n')
+        return true;
+      if (!isWhitespace(c))
+        break;
     }
+    return false;
+  }
 
-    auto isEndQuote = [&](CharT c) -> bool {
-      if (isDoubleQuote(text[i]))
-        return isDoubleQuote(c);
-      return isSingleQuote(c); // 简化处理
-    };
+protected:
+  StringT buffer;
 
-    size_t iBefore = i;
-    size_t oBefore = output.length();
-    StringT str = u"\"";
-    i++;
+private:
+  void insertAt(size_t pos, const char *ascii) {
+    for (; *ascii != '\0'; ascii++, pos++) {
+      buffer.insert(pos, 1, CharT(*ascii));
+    }
+  }
+};
 
-    while (true) {
-      if (i >= text.length()) {
-        size_t iPrev = prevNonWhitespaceIndex(i - 1);
-        if (!stopAtDelimiter && iPrev < text.length() &&
-            isDelimiter(text[iPrev])) {
-          i = iBefore;
-          output = output.substr(0, oBefore);
-          return parseString(true, static_cast<size_t>(-1));
-        }
-        str = insertBeforeLastWhitespace(str, u"\"");
-        output += str;
-        return true;
-      }
+// Stands in for OutputBuffer when a repair is only analysed. It keeps the
+// length, which the parser saves and truncates back to, and only the last
+// characters in a ring, since the edits that look at the content (a comma
+// or bracket inserted before trailing whitespace, a comma or quote
+// stripped) reach no further back in practice. Beyond the ring an edit
+// changes just the length. Appending is a store per character; the rarer
+// edits unpack the ring and pack it again.
+template <typename CharT, typename Alloc = std::allocator<CharT>>
+class NullOutput {
+public:
+  using StringT = std::basic_string<CharT, std::char_traits<CharT>, Alloc>;
+  static constexpr bool discards = true;
 
-      if (i == stopAtIndex) {
-        str = insertBeforeLastWhitespace(str, u"\"");
-        output += str;
-        return true;
-      }
+  explicit NullOutput(StringT &&) {}
 
-      if (isEndQuote(text[i])) {
-        size_t iQuote = i;
-        size_t oQuote = str.length();
-        str += '"';
-        i++;
-        output += str;
+  size_t length() const { return size; }
+  void reserve(size_t) {}
+  void follow(std::basic_string_view<CharT>, const size_t &) {}
+  bool settle() { return true; }
+  bool sent() const { return false; }
+  template <typename Frames>
+  void valueStart(size_t, const Frames &, int, bool) {}
 
-        parseWhitespaceAndSkipComments(false);
+  // Starts the output as the first `length` code units of `text`.
+  void assume(std::basic_string_view<CharT> text, size_t length) {
+    size = 0;
+    first = 0;
+    append(text, 0, length);
+  }
 
-        if (stopAtDelimiter || i >= text.length() ||
-            (i < text.length() &&
-             (isDelimiter(text[i]) || isQuote(text[i]) || isDigit(text[i])))) {
-          parseConcatenatedString();
-          return true;
-        }
+  NullOutput &operator+=(CharT c) {
+    tail[size & Mask] = c;
+    size++;
+    return *this;
+  }
 
-        size_t iPrevchar = prevNonWhitespaceIndex(iQuote - 1);
-        CharT prevchar = (iPrevchar < text.length()) ? text[iPrevchar] : '\0';
+  NullOutput &operator+=(const char *ascii) {
+    for (; *ascii != '\0'; ascii++) {
+      *this += CharT(*ascii);
+    }
+    return *this;
+  }
 
-        if (prevchar == ',') {
-          i = iBefore;
-          output = output.substr(0, oBefore);
-          return parseString(false, iPrevchar);
-        }
+  void insert(size_t pos, CharT c) { insertAt(pos, &c, 1); }
 
-        if (isDelimiter(prevchar)) {
-          i = iBefore;
-          output = output.substr(0, oBefore);
-          return parseString(true, static_cast<size_t>(-1));
-        }
+  void append(std::basic_string_view<CharT> s, size_t pos, size_t count) {
+    for (size_t k = count > Capacity ? count - Capacity : 0; k < count; k++) {
+      tail[(size + k) & Mask] = s[pos + k];
+    }
+    size += count;
+  }
 
-        output = output.substr(0, oBefore);
-        i = iQuote + 1;
-        str = str.substr(0, oQuote) + u"\\" + str.substr(oQuote);
-        continue;
-      }
+  void truncate(size_t length) {
+    first = std::min(oldest(), length);
+    size = length;
+  }
+
+  void prepend(const char *ascii) { insertAscii(0, ascii); }
+
+  void insertBeforeLastWhitespace(const char *ascii) {
+    size_t index = size;
+    while (index > oldest() && isWhitespace(at(index - 1))) {
+      index--;
+    }
+    insertAscii(index, ascii);
+  }
+
+  void stripLastOccurrence(CharT toStrip, bool = false) {
+    for (size_t k = size; k > oldest(); k--) {
+      if (at(k - 1) == toStrip) {
+        removeAtIndex(k - 1, 1);
+        return;
+      }
+    }
+    // Not in the ring: assume it is further back, as it usually is.
+    if (oldest() > 0) {
+      first = oldest() - 1;
+      size--;
+    }
+  }
+
+  void removeAtIndex(size_t start, size_t count) {
+    if (start >= size)
+      return;
+    count = std::min(count, size - start);
+    CharT units[Capacity + Slack];
+    size_t n = unpack(units);
+    size_t from = oldest();
+    if (start + count > from) {
+      size_t to = start + count - from;
+      from = std::max(start, from) - from;
+      std::copy(units + to, units + n, units + from);
+      n -= to - from;
+    }
+    size -= count;
+    pack(units, n);
+  }
+
+  template <typename Positions>
+  void removeAtIndices(const Positions &positions) {
+    for (size_t k = positions.size(); k > 0; k--) {
+      removeAtIndex(positions[k - 1], 1);
+    }
+  }
+
+  void stripTrailingComma() {
+    for (size_t k = size; k > oldest(); k--) {
+      CharT c = at(k - 1);
+      if (c == ',') {
+        removeAtIndex(k - 1, 1);
+        return;
+      }
+      if (!isWhitespace(c))
+        return;
+    }
+  }
+
+  bool endsWithCommaOrNewline() const {
+    for (size_t k = size; k > oldest(); k--) {
+      CharT c = at(k - 1);
+      if (c == ',' || c == '\n')
+        return true;
+      if (!isWhitespace(c))
+        break;
+    }
+    return false;
+  }
+
+private:
+  // Inserted literals are shorter than Slack.
+  static constexpr size_t Capacity = 64;
+  static constexpr size_t Mask = Capacity - 1;
+  static constexpr size_t Slack = 8;
+  CharT tail[Capacity];
+  size_t first = 0; // the ring holds the output from here on, up to its size
+  size_t size = 0;
+
+  // Where the characters the ring holds start.
+  size_t oldest() const {
+    return size - std::min(size - first, Capacity);
+  }
+
+  CharT at(size_t pos) const { return tail[pos & Mask]; }
+
+  // Copies the ring out, oldest character first.
+  size_t unpack(CharT *units) const {
+    size_t from = oldest();
+    for (size_t k = from; k < size; k++) {
+      units[k - from] = at(k);
+    }
+    return size - from;
+  }
+
+  // Makes the last `count` of `units` the end of the output.
+  void pack(const CharT *units, size_t count) {
+    if (count > Capacity) {
+      units += count - Capacity;
+      count = Capacity;
+    }
+    for (size_t k = 0; k < count; k++) {
+      tail[(size - count + k) & Mask] = units[k];
+    }
+    first = size - count;
+  }
+
+  void insertAscii(size_t pos, const char *ascii) {
+    CharT units[Slack];
+    size_t count = 0;
+    for (; ascii[count] != '\0'; count++) {
+      units[count] = CharT(ascii[count]);
+    }
+    insertAt(pos, units, count);
+  }
+
+  void insertAt(size_t pos, const CharT *s, size_t count) {
+    CharT units[Capacity + Slack];
+    size_t from = oldest();
+    size_t n = unpack(units);
+    if (pos >= from) {
+      size_t offset = pos - from;
+      std::copy_backward(units + offset, units + n, units + n + count);
+      std::copy(s, s + count, units + offset);
+      n += count;
+    }
+    size += count;
+    pack(units, n);
+  }
+};
+
+// A point where a value starts that the repair of a longer text passes the
+// same way: the text from `position` on repairs after the first `length`
+// units of the output, with `frames` open in the parser and `depth`
+// containers, in a document after the first of a sequence with `sequence`.
+// `floor` is the first unit of the output edited since it was passed; the
+// point stands as long as that is not before `length`.
+struct ResumePoint {
+  size_t position = static_cast<size_t>(-1);
+  size_t length = 0;
+  size_t floor = static_cast<size_t>(-1);
+  int depth = 0;
+  bool sequence = false;
+  std::string frames;
+};
+using ResumePoints = std::array<ResumePoint, 4>;
+
+// Output that goes on from text kept as it is, for a JSONRepairStream
+// snapshot or a completion: it takes over its storage with the end of that
+// text in it. It notes the first position it edited, so that the caller
+// knows how much of the output is still that text, and whether an edit
+// looked for something all the way to its start, which the text before it
+// might have held instead. Given somewhere to keep them, it also keeps the
+// last few value starts passed, from which a stream repairs its next
+// snapshot.
+template <typename CharT> class ResumedOutput : public OutputBuffer<CharT> {
+  using Base = OutputBuffer<CharT>;
+
+public:
+  using typename Base::StringT;
+
+  explicit ResumedOutput(StringT &&storage) : Base(StringT()) {
+    this->buffer = std::move(storage);
+  }
+
+  // Everything from here on may differ from what was handed over.
+  size_t edited() const { return firstEdit; }
+  bool reachedStart() const { return searchedAll; }
+
+  void keep(ResumePoints &kept) { points = &kept; }
+
+  template <typename Frames>
+  void valueStart(size_t position, const Frames &frames, int depth,
+                  bool sequence) {
+    if (!points)
+      return;
+    settleEdits();
+    ResumePoint &point = (*points)[passed++ % points->size()];
+    point.position = position;
+    point.length = this->buffer.length();
+    point.floor = static_cast<size_t>(-1);
+    point.depth = depth;
+    point.sequence = sequence;
+    point.frames.assign(frames.begin(), frames.end());
+  }
+
+  // The last value start passed that still stands, null when there is none.
+  ResumePoint *lastStanding() {
+    if (!points)
+      return nullptr;
+    settleEdits();
+    size_t count = std::min(passed, points->size());
+    for (size_t k = 1; k <= count; k++) {
+      ResumePoint &point = (*points)[(passed - k) % points->size()];
+      if (point.floor >= point.length)
+        return &point;
+    }
+    return nullptr;
+  }
+
+  // The output holds the text before the resume point already.
+  void assume(std::basic_string_view<CharT>, size_t) {}
+
+  void insert(size_t pos, CharT c) {
+    mark(pos);
+    Base::insert(pos, c);
+  }
+
+  void truncate(size_t length) {
+    mark(length);
+    Base::truncate(length);
+  }
+
+  void prepend(const char *ascii) {
+    mark(0);
+    searchedAll = true;
+    Base::prepend(ascii);
+  }
+
+  void insertBeforeLastWhitespace(const char *ascii) {
+    mark(searched(contentEnd()));
+    Base::insertBeforeLastWhitespace(ascii);
+  }
+
+  void stripLastOccurrence(CharT toStrip, bool stripRemaining = false) {
+    size_t pos = this->buffer.rfind(toStrip);
+    mark(pos);
+    searched(pos == StringT::npos ? 0 : pos);
+    Base::stripLastOccurrence(toStrip, stripRemaining);
+  }
+
+  void removeAtIndex(size_t start, size_t count) {
+    mark(start);
+    Base::removeAtIndex(start, count);
+  }
+
+  template <typename Positions>
+  void removeAtIndices(const Positions &positions) {
+    if (!positions.empty())
+      mark(positions[0]);
+    Base::removeAtIndices(positions);
+  }
+
+  void stripTrailingComma() {
+    size_t end = searched(contentEnd());
+    mark(end > 0 ? end - 1 : 0);
+    Base::stripTrailingComma();
+  }
+
+  bool endsWithCommaOrNewline() {
+    searched(contentEnd());
+    return Base::endsWithCommaOrNewline();
+  }
+
+private:
+  size_t firstEdit = static_cast<size_t>(-1);
+  bool searchedAll = false;
+  ResumePoints *points = nullptr;
+  size_t passed = 0;
+  // The first position edited since the points last heard of the edits.
+  size_t recentEdit = static_cast<size_t>(-1);
+
+  void mark(size_t pos) {
+    firstEdit = std::min(firstEdit, pos);
+    recentEdit = std::min(recentEdit, pos);
+  }
+
+  void settleEdits() {
+    size_t count = std::min(passed, points->size());
+    for (size_t k = 1; k <= count; k++) {
+      ResumePoint &point = (*points)[(passed - k) % points->size()];
+      point.floor = std::min(point.floor, recentEdit);
+    }
+    recentEdit = static_cast<size_t>(-1);
+  }
+
+  // A search back that stopped at `pos`, the start when it found nothing.
+  size_t searched(size_t pos) {
+    searchedAll = searchedAll || pos == 0;
+    return pos;
+  }
+
+  // The length without the trailing whitespace.
+  size_t contentEnd() const {
+    size_t end = this->buffer.length();
+    while (end > 0 && isWhitespace(this->buffer[end - 1])) {
+      end--;
+    }
+    return end;
+  }
+};
+
+// One edit of a text: the `length` units at `offset` are replaced with the
+// next `count` units of the text the edits insert, which is kept in one
+// string for all of them.
+struct TextChange {
+  size_t offset;
+  size_t length;
+  size_t count;
+};
+
+// Stands in for OutputBuffer when a repair is returned as edits of the
+// text. The output is kept as pieces, each a run copied from the text or a
+// run of characters the repair added, so that it costs memory in proportion
+// to the repairs rather than to the document. The parser writes most of the
+// text one character at a time; a character counts as copied when it is
+// the next one after the last copy, or the one the parser is at or has
+// just passed. Any other choice would still give the same output, only in
+// more edits.
+template <typename CharT> class EditOutput {
+public:
+  using StringT = std::basic_string<CharT>;
+  using TextT = std::basic_string_view<CharT>;
+  static constexpr bool discards = false;
+
+  explicit EditOutput(StringT &&storage) : storage(std::move(storage)) {}
+
+  // Reads copies from `source`, at the parser's `position`.
+  void follow(TextT source, const size_t &position) {
+    text = source;
+    at = &position;
+  }
+
+  size_t length() const { return size; }
+  void reserve(size_t) {}
+  bool sent() const { return false; }
+  template <typename Frames>
+  void valueStart(size_t, const Frames &, int, bool) {}
+  StringT take() { return std::move(storage); }
+
+  // Refuses to go on, at the next value, once the pieces take more memory
+  // than a quarter of the text read so far and a few kilobytes, for a
+  // caller that would rather build the output then.
+  void limit() { limited = true; }
+  bool settle() {
+    return !limited ||
+           pieces.size() * sizeof(Piece) + addedUnits.size() * sizeof(CharT) <=
+               *at * sizeof(CharT) / 4 + 4096;
+  }
+
+  EditOutput &operator+=(CharT c) {
+    put(c);
+    return *this;
+  }
+
+  EditOutput &operator+=(const char *ascii) {
+    for (; *ascii != '\0'; ascii++) {
+      put(CharT(*ascii));
+    }
+    return *this;
+  }
+
+  void insert(size_t pos, CharT c) { insertAt(pos, &c, 1); }
+
+  void append(TextT s, size_t pos, size_t count) {
+    if (s.data() == text.data()) {
+      copy(pos, count);
+    } else {
+      add(s.data() + pos, count);
+    }
+  }
+
+  void truncate(size_t length) { removeAtIndex(length, size - length); }
+
+  void prepend(const char *ascii) { insertAscii(0, ascii); }
+
+  void insertBeforeLastWhitespace(const char *ascii) {
+    CharT last;
+    insertAscii(lastBefore([](CharT c) { return isWhitespace(c); }, last),
+                ascii);
+  }
+
+  void stripLastOccurrence(CharT toStrip, bool stripRemaining = false) {
+    CharT last;
+    size_t end = lastBefore([&](CharT c) { return c != toStrip; }, last);
+    if (end == 0)
+      return;
+    if (stripRemaining) {
+      truncate(end - 1);
+    } else {
+      removeAtIndex(end - 1, 1);
+    }
+  }
+
+  void removeAtIndex(size_t start, size_t count) {
+    if (start >= size)
+      return;
+    count = std::min(count, size - start);
+    size_t first = split(start);
+    size_t last = split(start + count);
+    pieces.erase(pieces.begin() + first, pieces.begin() + last);
+    size -= count;
+    uncopy();
+  }
+
+  // Same as calling removeAtIndex(pos, 1) for each of the strictly
+  // ascending offsets, last one first, but in a single pass.
+  template <typename Positions>
+  void removeAtIndices(const Positions &positions) {
+    size_t count = 0;
+    while (count < positions.size() && positions[count] < size) {
+      count++;
+    }
+    if (count == 0)
+      return;
+    std::vector<Piece> kept;
+    kept.reserve(pieces.size() + count);
+    size_t start = 0; // of the piece in the output
+    size_t k = 0;
+    for (const Piece &piece : pieces) {
+      size_t from = 0;
+      for (; k < count && positions[k] - start < piece.length; k++) {
+        size_t pos = positions[k] - start;
+        if (pos > from)
+          kept.push_back({piece.from + from, pos - from, piece.added});
+        from = pos + 1;
+      }
+      if (piece.length > from)
+        kept.push_back({piece.from + from, piece.length - from, piece.added});
+      start += piece.length;
+    }
+    pieces.swap(kept);
+    size -= count;
+    uncopy();
+  }
+
+  void stripTrailingComma() {
+    CharT last;
+    size_t end = lastBefore([](CharT c) { return isWhitespace(c); }, last);
+    if (end > 0 && last == ',')
+      removeAtIndex(end - 1, 1);
+  }
+
+  bool endsWithCommaOrNewline() const {
+    CharT last;
+    size_t end = lastBefore(
+        [](CharT c) { return c != '\n' && isWhitespace(c); }, last);
+    return end > 0 && (last == ',' || last == '\n');
+  }
+
+  // The edits that turn the text into the output, in text order, with the
+  // text they insert appended to `inserted`. What a piece copies from
+  // before the end of an earlier one counts as inserted.
+  void changes(std::vector<TextChange> &out, StringT &inserted) const {
+    size_t from = 0;
+    size_t mark = inserted.length();
+    auto flush = [&](size_t to) {
+      size_t count = inserted.length() - mark;
+      if (to > from || count > 0)
+        out.push_back({from, to - from, count});
+      mark = inserted.length();
+    };
+    for (const Piece &piece : pieces) {
+      size_t end = piece.from + piece.length;
+      if (piece.added || end <= from) {
+        inserted.append(data(piece), piece.length);
+        continue;
+      }
+      size_t start = std::max(piece.from, from);
+      inserted.append(data(piece), start - piece.from);
+      flush(start);
+      from = end;
+    }
+    flush(text.length());
+  }
+
+  // The same as edits that each hold their text.
+  template <typename Edit> void edits(std::vector<Edit> &out) const {
+    std::vector<TextChange> list;
+    StringT inserted;
+    changes(list, inserted);
+    out.reserve(list.size());
+    size_t at = 0;
+    for (const TextChange &change : list) {
+      out.push_back(Edit{change.offset, change.length,
+                         inserted.substr(at, change.count)});
+      at += change.count;
+    }
+  }
+
+private:
+  static constexpr size_t Reach = 8;
+
+  struct Piece {
+    size_t from; // in the text, or in `addedUnits` when added
+    size_t length;
+    bool added;
+  };
+
+  StringT storage;
+  TextT text;
+  const size_t *at = nullptr;
+  std::vector<Piece> pieces;
+  StringT addedUnits;
+  size_t size = 0;
+  size_t cursor = 0; // the end of the last copy
+  bool limited = false;
+
+  const CharT *data(const Piece &piece) const {
+    return (piece.added ? addedUnits.data() : text.data()) + piece.from;
+  }
+
+  // After a removal: text after the last copy left is free to be copied
+  // again.
+  void uncopy() {
+    cursor = 0;
+    for (size_t k = pieces.size(); k > 0; k--) {
+      if (!pieces[k - 1].added) {
+        cursor = pieces[k - 1].from + pieces[k - 1].length;
+        break;
+      }
+    }
+  }
+
+  void put(CharT c) {
+    TextT s = text;
+    size_t i = *at;
+    if (cursor < s.length() && cursor <= i + Reach && s[cursor] == c) {
+      copy(cursor, 1);
+    } else if (i > cursor && s[i - 1] == c) {
+      copy(i - 1, 1);
+    } else if (i >= cursor && i < s.length() && s[i] == c) {
+      copy(i, 1);
+    } else {
+      // A few skipped characters back, such as a quote replaced before the
+      // string the parser went past.
+      size_t end = std::min({i, s.length(), cursor + Reach});
+      size_t j = cursor;
+      while (j < end && s[j] != c) {
+        j++;
+      }
+      if (j < end) {
+        copy(j, 1);
+      } else {
+        add(&c, 1);
+      }
+    }
+  }
+
+  void copy(size_t from, size_t count) {
+    if (!pieces.empty() && !pieces.back().added &&
+        pieces.back().from + pieces.back().length == from) {
+      pieces.back().length += count;
+    } else {
+      pieces.push_back({from, count, false});
+    }
+    size += count;
+    cursor = from + count;
+  }
+
+  void add(const CharT *units, size_t count) {
+    if (!pieces.empty() && pieces.back().added &&
+        pieces.back().from + pieces.back().length == addedUnits.length()) {
+      pieces.back().length += count;
+    } else {
+      pieces.push_back({addedUnits.length(), count, true});
+    }
+    addedUnits.append(units, count);
+    size += count;
+  }
+
+  // Ends a piece at `pos`, splitting the one across it, and returns the
+  // index of the piece that starts there.
+  size_t split(size_t pos) {
+    size_t k = pieces.size();
+    size_t end = size;
+    while (k > 0 && end > pos) {
+      Piece &piece = pieces[k - 1];
+      size_t start = end - piece.length;
+      if (start < pos) {
+        Piece rest = piece;
+        piece.length = pos - start;
+        rest.from += piece.length;
+        rest.length -= piece.length;
+        pieces.insert(pieces.begin() + k, rest);
+        return k;
+      }
+      end = start;
+      k--;
+    }
+    return k;
+  }
+
+  void insertAscii(size_t pos, const char *ascii) {
+    size_t k = split(pos);
+    size_t from = addedUnits.length();
+    for (; *ascii != '\0'; ascii++) {
+      addedUnits += CharT(*ascii);
+    }
+    size_t count = addedUnits.length() - from;
+    pieces.insert(pieces.begin() + k, Piece{from, count, true});
+    size += count;
+  }
+
+  void insertAt(size_t pos, const CharT *units, size_t count) {
+    size_t k = split(pos);
+    pieces.insert(pieces.begin() + k, Piece{addedUnits.length(), count, true});
+    addedUnits.append(units, count);
+    size += count;
+  }
+
+  // The length of the output up to its last character that `skip` is false
+  // for, which is stored in `last`; zero when there is none.
+  template <typename Skip> size_t lastBefore(Skip skip, CharT &last) const {
+    size_t end = size;
+    for (size_t k = pieces.size(); k > 0; k--) {
+      const CharT *units = data(pieces[k - 1]);
+      for (size_t m = pieces[k - 1].length; m > 0; m--, end--) {
+        if (!skip(units[m - 1])) {
+          last = units[m - 1];
+          return end;
+        }
+      }
+    }
+    return 0;
+  }
+};
+
+// Output that goes to a JSONRepairSink as the repair produces it. Between
+// values (see settle) the only edits left for what was written are at its
+// end: a trailing comma stripped, or a comma, colon or bracket inserted
+// before the whitespace, and so before the comma's whitespace too once it
+// is gone. A comma that is not trailing can still be stripped as the last
+// one in the output. Everything before the two goes to the sink once there
+// is a chunk of it, and positions count on from what went. A string,
+// retried and cut back while it is read, is held until it ends.
+template <typename CharT> class SinkOutput : public OutputBuffer<CharT> {
+  using Base = OutputBuffer<CharT>;
+
+public:
+  using typename Base::StringT;
+
+  explicit SinkOutput(StringT &&storage) : Base(std::move(storage)) {}
+
+  void to(JSONRepairSink<CharT> &target) { sink = &target; }
+
+  size_t length() const { return written + this->buffer.length(); }
+
+  // The parser sizes the output for the whole document.
+  void reserve(size_t capacity) {
+    Base::reserve(std::min(capacity, 2 * Chunk));
+  }
+
+  bool settle() {
+    StringT &buffer = this->buffer;
+    if (buffer.length() <= Chunk)
+      return true;
+    size_t end = contentEnd(buffer.length());
+    if (end > 0 && buffer[end - 1] == ',')
+      end = contentEnd(end - 1);
+    end = std::min(end, buffer.rfind(','));
+    return end == 0 || send(end);
+  }
+
+  // Writes what is left, once the repair is done.
+  bool flush() { return this->buffer.empty() || send(this->buffer.length()); }
+
+  void insert(size_t pos, CharT c) { Base::insert(pos - written, c); }
+
+  void truncate(size_t length) { Base::truncate(length - written); }
+
+  void removeAtIndex(size_t start, size_t count) {
+    Base::removeAtIndex(start - written, count);
+  }
+
+  template <typename Positions>
+  void removeAtIndices(const Positions &positions) {
+    struct Shifted {
+      const Positions &positions;
+      size_t by;
+      size_t size() const { return positions.size(); }
+      size_t operator[](size_t k) const { return positions[k] - by; }
+    };
+    Base::removeAtIndices(Shifted{positions, written});
+  }
+
+  // A document after the first is wrapped in an array together with it,
+  // which the sink cannot take back once it has part of the first.
+  bool sent() const { return written > 0; }
+
+private:
+  static constexpr size_t Chunk = 4096;
+  JSONRepairSink<CharT> *sink = nullptr;
+  size_t written = 0;
+
+  // The end of the buffer up to `end` without the whitespace before it.
+  size_t contentEnd(size_t end) const {
+    while (end > 0 && isWhitespace(this->buffer[end - 1])) {
+      end--;
+    }
+    return end;
+  }
+
+  bool send(size_t count) {
+    if (!sink->write(this->buffer.data(), count))
+      return false;
+    this->buffer.erase(0, count);
+    written += count;
+    return true;
+  }
+};
+
+// The heap memory of one repair: the output, the parser's frame stack and
+// deferred quote offsets, and the validator's container stack. A parser
+// works in a set lent to it and hands it back emptied, so a JSONRepairer
+// that keeps one set per code unit type reuses their capacity.
+template <typename CharT, typename Alloc = std::allocator<CharT>>
+struct RepairBuffers {
+  template <typename T>
+  using Rebind = typename std::allocator_traits<Alloc>::template rebind_alloc<T>;
+  using Stack = std::basic_string<char, std::char_traits<char>, Rebind<char>>;
+
+  explicit RepairBuffers(const Alloc &alloc = Alloc())
+      : output(alloc), frames(alloc), deferredQuotes(alloc),
+        validatorStack(alloc) {}
+
+  std::basic_string<CharT, std::char_traits<CharT>, Alloc> output;
+  Stack frames;
+  std::vector<size_t, Rebind<size_t>> deferredQuotes;
+  Stack validatorStack;
+};
+
+// --- JSONRepairError Implementation ---
+JSONRepairError::JSONRepairError(const std::string &message, size_t pos)
+    : std::runtime_error(message + " at position " + std::to_string(pos)),
+      position(pos) {}
+
+JSONRepairLimitError::JSONRepairLimitError(const std::string &message,
+                                           size_t pos, Limit limit)
+    : JSONRepairError(message, pos), limit(limit) {}
+
+// --- Errors without exceptions ---
+
+static const char *messageOf(JSONRepairErrorCode error) {
+  switch (error) {
+  case JSONRepairErrorCode::None:
+    return "";
+  case JSONRepairErrorCode::UnexpectedEnd:
+    return "Unexpected end of json string";
+  case JSONRepairErrorCode::UnexpectedCharacter:
+    return "Unexpected character";
+  case JSONRepairErrorCode::MaximumDepthExceeded:
+    return "Maximum depth exceeded";
+  case JSONRepairErrorCode::ObjectKeyExpected:
+    return "Object key expected";
+  case JSONRepairErrorCode::ColonExpected:
+    return "Colon expected";
+  case JSONRepairErrorCode::InvalidUnicodeCharacter:
+    return "Invalid unicode character";
+  case JSONRepairErrorCode::InvalidCharacter:
+    return "Invalid character";
+  case JSONRepairErrorCode::InputSizeLimit:
+    return "Input size limit exceeded";
+  case JSONRepairErrorCode::OutputSizeLimit:
+    return "Output size limit exceeded";
+  case JSONRepairErrorCode::StepLimit:
+    return "Step limit exceeded";
+  case JSONRepairErrorCode::Deadline:
+    return "Deadline exceeded";
+  case JSONRepairErrorCode::Cancelled:
+    return "Repair cancelled";
+  case JSONRepairErrorCode::WriteFailed:
+    return "Output write failed";
+  case JSONRepairErrorCode::DocumentSequence:
+    return "Document sequence after output was written";
+  }
+  return "";
+}
+
+static JSONRepairStatus failure(JSONRepairErrorCode error, size_t position) {
+  JSONRepairStatus status;
+  status.error = error;
+  status.position = position;
+  status.message = messageOf(error);
+  return status;
+}
+
+// Throws the exception the throwing API reports for `status`, rebuilding
+// the message the way the engine used to: the offending character is named,
+// and the position appended. Without exceptions, aborts.
+template <typename CharT>
+[[noreturn]] static void raise(const JSONRepairStatus &status,
+                               std::basic_string_view<CharT> text) {
+#if defined(__cpp_exceptions)
+  using Limit = JSONRepairLimitError::Limit;
+  std::string message = status.message;
+  switch (status.error) {
+  case JSONRepairErrorCode::UnexpectedCharacter:
+  case JSONRepairErrorCode::InvalidCharacter:
+    message += " " + Encoding<CharT>::characterAt(text, status.position);
+    break;
+  case JSONRepairErrorCode::InputSizeLimit:
+    throw JSONRepairLimitError(message, status.position, Limit::InputSize);
+  case JSONRepairErrorCode::OutputSizeLimit:
+    throw JSONRepairLimitError(message, status.position, Limit::OutputSize);
+  case JSONRepairErrorCode::StepLimit:
+    throw JSONRepairLimitError(message, status.position, Limit::Steps);
+  case JSONRepairErrorCode::Deadline:
+    throw JSONRepairLimitError(message, status.position, Limit::Deadline);
+  case JSONRepairErrorCode::Cancelled:
+    throw JSONRepairLimitError(message, status.position, Limit::Cancelled);
+  default:
+    break;
+  }
+  throw JSONRepairError(message, status.position);
+#else
+  (void)status;
+  (void)text;
+  std::abort();
+#endif
+}
+
+// --- Budgets ---
+
+static bool fitsInput(const JSONRepairOptions &options, size_t inputLength) {
+  return !options.maxInputSize || inputLength <= options.maxInputSize;
+}
+
+// Enforces the JSONRepairOptions of one repair call, apart from the input
+// size, which is checked before the repair starts. The parser calls step()
+// once per loop iteration, which is a single compare: the output, clock and
+// cancellation checks only run every checkInterval steps, and not at all
+// when none of them was asked for.
+class Budget {
+public:
+  Budget(const JSONRepairOptions &options, size_t inputLength)
+      : stepLimit(options.maxSteps ? options.maxSteps : UINT64_MAX),
+        deadline(options.deadline), cancellation(options.cancellation) {
+    if (options.maxOutputRatio > 0) {
+      double limit = static_cast<double>(inputLength) * options.maxOutputRatio;
+      outputLimit = limit < double(SIZE_MAX) ? static_cast<size_t>(limit)
+                                             : SIZE_MAX;
+      outputLimit = std::max<size_t>(outputLimit, 64);
+    }
+    polls = outputLimit != SIZE_MAX || cancellation != nullptr ||
+            deadline != std::chrono::steady_clock::time_point::max();
+    schedule();
+  }
+
+  // Counts a step. Returns false once a budget has run out; exceeded() then
+  // says which.
+  bool step(size_t outputLength) {
+    return ++steps < nextCheck || check(outputLength);
+  }
+
+  // Counts `count` steps at once, for the validator, which writes nothing.
+  bool advance(uint64_t count) {
+    steps += count;
+    return steps < nextCheck || check(0);
+  }
+
+  bool fitsOutput(size_t outputLength) const {
+    return outputLength <= outputLimit;
+  }
+
+  JSONRepairErrorCode exceeded() const { return error; }
+
+private:
+  static constexpr uint64_t checkInterval = 1024;
+
+  uint64_t steps = 0;
+  uint64_t nextCheck = 0;
+  uint64_t stepLimit;
+  size_t outputLimit = SIZE_MAX;
+  std::chrono::steady_clock::time_point deadline;
+  const JSONRepairCancellation *cancellation;
+  bool polls = false;
+  JSONRepairErrorCode error = JSONRepairErrorCode::None;
+
+  void schedule() {
+    uint64_t stepCheck = stepLimit == UINT64_MAX ? UINT64_MAX : stepLimit + 1;
+    nextCheck = polls && stepCheck - steps > checkInterval
+                    ? steps + checkInterval
+                    : stepCheck;
+  }
+
+  bool check(size_t outputLength) {
+    if (steps > stepLimit) {
+      error = JSONRepairErrorCode::StepLimit;
+    } else if (!fitsOutput(outputLength)) {
+      error = JSONRepairErrorCode::OutputSizeLimit;
+    } else if (cancellation && cancellation->cancelled()) {
+      error = JSONRepairErrorCode::Cancelled;
+    } else if (deadline != std::chrono::steady_clock::time_point::max() &&
+               std::chrono::steady_clock::now() >= deadline) {
+      error = JSONRepairErrorCode::Deadline;
+    } else {
+      schedule();
+      return true;
+    }
+    return false;
+  }
+};
+
+// --- Repair engine, instantiated per code unit type ---
+
+// Strict validation, below; the analysis runs it from inside a parse.
+template <typename CharT, typename Stack, bool Resumable = false>
+class Validator;
+
+// Repairer over one document. It does not recurse: each open object, array
+// or function call is a frame on an explicit stack, which parseValues
+// resumes once the value inside it ends, so nesting costs a byte of heap
+// rather than native stack. The cursor, the output, the frames and the
+// nesting depth live in fields. Everything the parser allocates, the result
+// included, comes from `Alloc`. With a NullOutput it builds no result and
+// notes the repairs it makes instead.
+template <typename CharT, typename Alloc = std::allocator<CharT>,
+          typename Output = OutputBuffer<CharT, Alloc>>
+class Parser {
+public:
+  using TextT = std::basic_string_view<CharT>;
+  using OutputT = std::basic_string<CharT, std::char_traits<CharT>, Alloc>;
+  using Buffers = RepairBuffers<CharT, Alloc>;
+
+  // Works in `buffers` and gives them back when destroyed, the output still
+  // in buffers.output. A lenient parser lists what it skipped in
+  // `unrecoverable`, when given; an analysing one notes its repairs in
+  // `analysis`. It goes on with the `spent` budget of a validator that read
+  // the text first, when given.
+  Parser(TextT text, const JSONRepairOptions &options,
+         Buffers &buffers,
+         std::vector<JSONRepairSpan> *unrecoverable = nullptr,
+         JSONRepairAnalysis *analysis = nullptr,
+         const Budget *spent = nullptr)
+      : text(text), index(text.data(), text.length()),
+        budget(spent ? *spent : Budget(options, text.length())),
+        buffers(buffers),
+        output(std::move(buffers.output)),
+        maxDepth(options.maxDepth <= 0 ? 100 : options.maxDepth),
+        lenient(options.lenient), unrecoverable(unrecoverable),
+        analysis(analysis),
+        deferredQuotes(std::move(buffers.deferredQuotes)),
+        frames(std::move(buffers.frames)) {
+    // Most repairs add a few quotes, commas and brackets. Sizing the output
+    // for that up front makes it, and so the result, the only allocation
+    // of a small document instead of one per doubling. A large document
+    // gets less room, which would mostly go unused; one that outgrows it
+    // doubles the output, and releaseSlack gives the rest back.
+    size_t room = text.length() <= (size_t(1) << 20) ? text.length() / 8
+                                                      : text.length() / 32;
+    output.reserve(text.length() + room + 16);
+    output.follow(text, i);
+  }
+
+  ~Parser() {
+    if constexpr (!Output::discards)
+      buffers.output = output.take();
+    buffers.deferredQuotes = std::move(deferredQuotes);
+    buffers.deferredQuotes.clear();
+    buffers.frames = std::move(frames);
+    buffers.frames.clear();
+  }
+
+  // Repairs the text. On success the document is in buffers.output once
+  // the parser is gone.
+  JSONRepairStatus parse() {
+    parseMarkdownCodeBlock({"```", "[```", "{```"});
+    return finish(parseValue());
+  }
+
+  // Repairs the text from `position` on, where the validator stopped
+  // trusting it, as if the valid JSON before had been parsed. A value inside
+  // the first `depth` containers of `stack` ends there, or starts there
+  // unless `ended`. The output stands for the repair of the text before: a
+  // NullOutput assumes it, and a ResumedOutput was handed it.
+  template <typename Stack>
+  JSONRepairStatus parseFrom(size_t position, const Stack &stack,
+                             size_t depth, bool ended = true) {
+    i = position;
+    output.assume(text, position);
+    openFrames(stack, 0, depth, ended);
+    return finish(parseValues(0, ended));
+  }
+
+  // Repairs the text from a value start that the parse of a shorter text
+  // passed, with the frames and depth it had there; see ResumePoint.
+  JSONRepairStatus parseFrom(const ResumePoint &point) {
+    i = point.position;
+    output.assume(text, point.position);
+    frames.assign(point.frames.begin(), point.frames.end());
+    currentDepth = point.depth;
+    sequence = point.sequence;
+    return finish(parseValues(0, false));
+  }
+
+  const Output &written() const { return output; }
+  Output &written() { return output; }
+
+private:
+  // Opens frames for the containers `from` to `depth` of a validator's
+  // stack, in the innermost of which a value ends at the cursor, or starts
+  // there unless `ended`.
+  template <typename Stack>
+  void openFrames(const Stack &stack, size_t from, size_t depth, bool ended) {
+    for (size_t k = from; k < depth; k++) {
+      bool array = k + 1 < depth || !ended || text[i] == ','
+                       ? stack[k] == '['
+                       : text[i] == ']';
+      frames += array ? Frame::Array
+                      : static_cast<char>(Frame::ObjectValue |
+                                          Frame::ColonFlag);
+    }
+    currentDepth += static_cast<int>(depth - from);
+  }
+
+  // The top level after the value: trailing commas, fences, brackets and
+  // further documents. A parse resumed in a document after the first of a
+  // sequence goes on with the documents after it.
+  JSONRepairStatus finish(bool processed) {
+    if (sequence) {
+      if (processed)
+        parseDocuments(false);
+      output += "\n]";
+      return finishTopLevel(false, JSONRepairErrorCode::UnexpectedCharacter);
+    }
+    if (!processed) {
+      fail(JSONRepairErrorCode::UnexpectedEnd, text.length());
+    }
+    bool empty = emptyCall;
+
+    parseMarkdownCodeBlock({"```", "```]", "```}"});
+
+    bool processedComma = parseCharacter(',');
+    if (processedComma) {
+      parseWhitespaceAndSkipComments();
+    }
+
+    // A sink that has part of the first document cannot have it wrapped.
+    bool sequence = i < text.length() && isStartOfValue(text[i]) &&
+                    output.endsWithCommaOrNewline();
+    JSONRepairErrorCode trailing =
+        sequence && output.sent() ? JSONRepairErrorCode::DocumentSequence
+                                  : JSONRepairErrorCode::UnexpectedCharacter;
+    if (sequence && !output.sent()) {
+      empty = false;
+      if (!processedComma) {
+        output.insertBeforeLastWhitespace(",");
+      }
+      parseNewlineDelimitedJSON();
+    } else if (processedComma) {
+      note(JSONRepairCategory::RedundantComma);
+      output.stripLastOccurrence(',');
+    }
+    return finishTopLevel(empty, trailing);
+  }
+
+  // The end of the top level: redundant brackets, then text that is not
+  // part of the document, with `trailing` the error for it.
+  JSONRepairStatus finishTopLevel(bool empty, JSONRepairErrorCode trailing) {
+    while (i < text.length() && (text[i] == '}' || text[i] == ']')) {
+      note(JSONRepairCategory::RedundantBracket);
+      i++;
+      parseWhitespaceAndSkipComments();
+    }
+
+    if (i < text.length() && lenient) {
+      skipped(trailing, i, text.length());
+      i = text.length();
+    }
+    if (i < text.length()) {
+      fail(trailing, i);
+    } else if (!budget.fitsOutput(output.length())) {
+      fail(JSONRepairErrorCode::OutputSizeLimit, i);
+    }
+    // A call around nothing leaves an empty output, which is no document.
+    // It fails as a text without a value does, or, when text was skipped, as
+    // a strict repair does at the first text skipped.
+    if (empty && firstSkipped.error != JSONRepairErrorCode::None) {
+      fail(firstSkipped.error, firstSkipped.position);
+    } else if (empty) {
+      fail(JSONRepairErrorCode::UnexpectedEnd, text.length());
+    }
+    return status;
+  }
+
+  using Enc = Encoding<CharT>;
+  template <typename T> using Rebind = typename Buffers::template Rebind<T>;
+
+  TextT text;
+  StructuralIndex<CharT> index;
+  Budget budget;
+  JSONRepairStatus status;
+  Buffers &buffers;
+  Output output;
+  size_t i = 0;
+  int currentDepth = 0;
+  int maxDepth;
+  bool lenient;
+  std::vector<JSONRepairSpan> *unrecoverable;
+  JSONRepairSpan firstSkipped{JSONRepairErrorCode::None, 0, 0};
+  // The value that just ended is a function call around nothing, or around
+  // such a call, which writes nothing.
+  bool emptyCall = false;
+  JSONRepairAnalysis *analysis;
+  // Start of a plain string scan that ran to the end of the text; see
+  // parseString.
+  size_t stringReachesEnd = TextT::npos;
+  // Analysis: the values skipValidValues() lets pass before it next tries
+  // the validator, and how many it lets pass after the next miss.
+  size_t skipWait = 0;
+  size_t skipBackoff = 0;
+  // The furthest a string was read before it was cut back to end earlier.
+  // A longer text is repaired the same way only up to a little before it.
+  size_t reach = 0;
+  // The top level holds several documents, and the parse is past the first.
+  bool sequence = false;
+  SearchMemo blockCommentEnd;
+  SearchMemo lineCommentEnd;
+  // State of the string chain in parseConcatenatedString.
+  bool concatenating = false;
+  bool chainContinues = false;
+  std::vector<size_t, Rebind<size_t>> deferredQuotes;
+
+  // Records the first error, the one the engine used to throw, and moves to
+  // the end of the text, where every loop stops, so that the parse winds
+  // down without exceptions. Returns false for the caller to pass on.
+  bool fail(JSONRepairErrorCode error, size_t position) {
+    if (status)
+      status = failure(error, position);
+    i = text.length();
+    return false;
+  }
+
+  // Analysis: notes a repair of the kind `category` at `position`, the
+  // cursor by default. A repairing parser compiles this away.
+  void note(JSONRepairCategory category) { note(category, i); }
+
+  void note(JSONRepairCategory category, size_t position) {
+    if constexpr (Output::discards) {
+      uint32_t bit = uint32_t(1) << static_cast<unsigned>(category);
+      if (!(analysis->categories & bit)) {
+        analysis->categories |= bit;
+        analysis->positions[static_cast<size_t>(category)] = position;
+      }
+    } else {
+      (void)category;
+      (void)position;
+    }
+  }
+
+  // Lenient mode: notes that the text from `start` to `end` was left out,
+  // or quoted, in place of failing with `error`.
+  void skipped(JSONRepairErrorCode error, size_t start, size_t end) {
+    if (firstSkipped.error == JSONRepairErrorCode::None)
+      firstSkipped = {error, start, end - start};
+    if (unrecoverable)
+      unrecoverable->push_back({error, start, end - start});
+  }
+
+  // What a value parser did: nothing, a whole value, or it opened an
+  // object, array or call that now waits on `frames` for a value inside.
+  enum class Outcome { Rejected, Parsed, Pending };
+
+  // One byte per open object, array or function call, saying what it waits
+  // for. An object waiting for a value also keeps whether the colon was
+  // there and whether the text ended before the value, which decide how a
+  // missing value is repaired.
+  struct Frame {
+    static constexpr char Array = 0;
+    static constexpr char ObjectKey = 1; // a key written as a function call
+    static constexpr char ObjectValue = 2;
+    static constexpr char Call = 3; // the argument of a function call
+    static constexpr char KindMask = 3;
+    static constexpr char ColonFlag = 4;
+    static constexpr char TruncatedFlag = 8;
+  };
+  typename Buffers::Stack frames;
+
+  bool parseWhitespaceAndSkipComments(bool skipNewline = true) {
+    // Most calls stop at once, on an ASCII unit that starts a value or is a
+    // delimiter; special whitespace is never ASCII.
+    if (i < text.length() && text[i] != '/' &&
+        hasClass(text[i], CharClass::Printable))
+      return false;
+    size_t start = i;
+
+    parseWhitespace(skipNewline);
+    while (parseComment()) {
+      parseWhitespace(skipNewline);
+    }
+
+    return i > start;
+  }
+
+  bool parseWhitespace(bool skipNewline) {
+    auto isWhiteSpace = skipNewline ? isWhitespace : isWhitespaceExceptNewline;
+    size_t start = i;
+    while (i < text.length()) {
+      CharT c = text[i];
+      if (isWhiteSpace(c)) {
+        output += c;
+        i++;
+      } else if (size_t length = Enc::specialWhitespaceAt(text, i)) {
+        note(JSONRepairCategory::Whitespace);
+        output += ' ';
+        i += length;
+      } else {
+        break;
+      }
+    }
+    return i > start;
+  }
+
+  bool parseComment() {
+    if (i + 1 < text.length() && text[i] == '/' && text[i + 1] == '*') {
+      note(JSONRepairCategory::Comment);
+      i = blockCommentEnd.find(i + 2, text.length(), [&](size_t k) {
+        return k + 1 < text.length() && text[k] == '*' && text[k + 1] == '/';
+      });
+      if (i + 1 < text.length())
+        i += 2;
+      return true;
+    }
+    if (i + 1 < text.length() && text[i] == '/' && text[i + 1] == '/') {
+      note(JSONRepairCategory::Comment);
+      i = lineCommentEnd.find(i, text.length(),
+                              [&](size_t k) { return text[k] == '\n'; });
+      return true;
+    }
+    return false;
+  }
+
+  bool parseCharacter(CharT c) {
+    if (i < text.length() && text[i] == c) {
+      output += c;
+      i++;
+      return true;
+    }
+    return false;
+  }
+
+  bool skipCharacter(CharT c) {
+    if (i < text.length() && text[i] == c) {
+      i++;
+      return true;
+    }
+    return false;
+  }
+
+  bool skipEscapeCharacter() { return skipCharacter('\\'); }
+
+  bool skipEllipsis() {
+    parseWhitespaceAndSkipComments();
+    if (i + 2 < text.length() && text[i] == '.' && text[i + 1] == '.' &&
+        text[i + 2] == '.') {
+      note(JSONRepairCategory::Ellipsis);
+      i += 3;
+      parseWhitespaceAndSkipComments();
+      skipCharacter(',');
+      return true;
+    }
+    return false;
+  }
+
+  bool parseMarkdownCodeBlock(std::initializer_list<const char *> fences) {
+    parseWhitespaceAndSkipComments();
+    for (const char *fence : fences) {
+      if (matchesAt(i, fence)) {
+        note(JSONRepairCategory::CodeFence);
+        i += std::strlen(fence);
+        if (i < text.length() && isFunctionNameCharStart(text[i])) {
+          while (i < text.length() && isFunctionNameChar(text[i])) {
+            i++;
+          }
+        }
+        parseWhitespaceAndSkipComments();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Whether the ASCII literal `s` occurs in the text at `pos`.
+  bool matchesAt(size_t pos, const char *s) const {
+    size_t length = std::strlen(s);
+    return pos + length <= text.length() &&
+           std::equal(s, s + length, text.begin() + pos);
+  }
+
+  size_t prevNonWhitespaceIndex(size_t start) {
+    size_t prev = start;
+    while (prev > 0 && isWhitespace(text[prev - 1])) {
+      prev--;
+    }
+    return prev;
+  }
+
+  // Parses one value. Objects, arrays and function calls do not recurse:
+  // each open one is a frame on `frames`, waiting for the value inside it,
+  // and the loop below hands every finished value to the frame on top. The
+  // native stack stays flat however deep the document nests.
+  bool parseValue() { return parseValues(frames.size(), false); }
+
+  // The loop of parseValue, for the frames above `base`. With `ended`, a
+  // value has just ended at the cursor and goes to the frame on top first.
+  bool parseValues(size_t base, bool ended) {
+    while (true) {
+      bool processed = true;
+      if (!ended) {
+        if (!status)
+          return false;
+        if (!budget.step(output.length()))
+          return fail(budget.exceeded(), i);
+        if (!output.settle())
+          return fail(JSONRepairErrorCode::WriteFailed, i);
+        if (currentDepth > maxDepth)
+          return fail(JSONRepairErrorCode::MaximumDepthExceeded, i);
+        // Whatever else the parse up to here read lies a few units past the
+        // cursor at most, for a keyword, an escape, a quote or a URL.
+        if (!frames.empty() && std::max(reach, i) + 16 <= text.length())
+          output.valueStart(i, frames, currentDepth, sequence);
+        parseWhitespaceAndSkipComments();
+        Outcome outcome = i < text.length() ? parseValueStartingWith(text[i])
+                                            : Outcome::Rejected;
+        if (outcome == Outcome::Pending)
+          continue; // a frame waits for the value inside it
+        processed = outcome == Outcome::Parsed;
+      }
+      ended = false;
+      while (true) {
+        parseWhitespaceAndSkipComments();
+        if (frames.size() == base)
+          return processed;
+        if constexpr (Output::discards) {
+          if (processed && !skipValidValues())
+            break;
+        }
+        // The common case of resume(), inline: a comma after an element.
+        if (processed && frames.back() == Frame::Array &&
+            i < text.length() && text[i] == ',') {
+          output += ',';
+          i++;
+          skipEllipsis();
+          break;
+        }
+        if (!resume(processed))
+          break; // the frame waits for its next value
+        processed = true;
+      }
+    }
+  }
+
+  // Goes straight to the parsers that can accept a value starting with `c`,
+  // in the order the full chain would try them.
+  Outcome parseValueStartingWith(CharT c) {
+    switch (c) {
+    case '{':
+      return parseObject();
+    case '[':
+      return parseArray();
+    case '"':
+    case '\'':
+    case '`':
+      return parsed(parseString());
+    case '\\':
+      // parseString moves past the backslash even when no quote follows.
+      if (parseString() || parseNumber() || parseKeywords())
+        return Outcome::Parsed;
+      if (Outcome outcome = parseUnquotedString(false);
+          outcome != Outcome::Rejected)
+        return outcome;
+      return parsed(parseRegex());
+    case '-':
+    case '.':
+    case 'e':
+    case 'E':
+    case '0':
+    case '1':
+    case '2':
+    case '3':
+    case '4':
+    case '5':
+    case '6':
+    case '7':
+    case '8':
+    case '9':
+      return parseNumber() ? Outcome::Parsed : parseUnquotedString(false);
+    case 't':
+    case 'f':
+    case 'n':
+    case 'T':
+    case 'F':
+    case 'N':
+      return parseKeywords() ? Outcome::Parsed : parseUnquotedString(false);
+    case '/':
+      return parsed(parseRegex());
+    default:
+      return quoteAt(text, i) ? parsed(parseString())
+                              : parseUnquotedString(false);
+    }
+  }
+
+  // Analysis: a value in an array or object has just ended. The validator
+  // runs through the valid JSON after it, where the engine would repair
+  // nothing, and the parse goes on from where it would resume the engine,
+  // as parseFrom does. Strings that an earlier one reaching the end of the
+  // text would cut at a delimiter are not valid JSON to the engine. Where
+  // the values need repairs one after the other, the validator is tried
+  // less and less often. Returns false when a value starts at the cursor.
+  bool skipValidValues() {
+    char kind = frames.back() & Frame::KindMask;
+    if (i >= text.length() || text[i] != ',' ||
+        stringReachesEnd != TextT::npos ||
+        (kind != Frame::Array && kind != Frame::ObjectValue))
+      return true;
+    if (skipWait > 0) {
+      skipWait--;
+      return true;
+    }
+    Validator<CharT, typename Buffers::Stack, true> validator(
+        text.data(), text.length(), maxDepth - currentDepth + 1,
+        buffers.validatorStack, &budget);
+    size_t end = validator.skipFrom(i, kind == Frame::Array ? '[' : '{');
+    if (end == i) {
+      skipWait = skipBackoff;
+      skipBackoff = std::min(2 * skipBackoff + 1, size_t(63));
+      return true;
+    }
+    skipBackoff = 0;
+    output.append(text, i, end - i);
+    i = end;
+    openFrames(buffers.validatorStack, 1, validator.resumeDepth(),
+               validator.resumeAfterValue());
+    return validator.resumeAfterValue();
+  }
+
+  static Outcome parsed(bool processed) {
+    return processed ? Outcome::Parsed : Outcome::Rejected;
+  }
+
+  // Continues the frame on top with the outcome of the value it waited for.
+  // Returns true when that closed the frame, which completes the value the
+  // frame stood for, and false when the frame waits for another value. An
+  // open frame stays on the stack and is updated in place.
+  bool resume(bool processed) {
+    char frame = frames.back();
+    bool emptyArgument = !processed || emptyCall;
+    emptyCall = false;
+    switch (frame & Frame::KindMask) {
+    case Frame::Array:
+      if (!processed) {
+        note(JSONRepairCategory::RedundantComma);
+        output.stripLastOccurrence(',');
+        return closeArray();
+      }
+      return continueArray(false);
+    case Frame::ObjectValue:
+      if (!processed) {
+        if (frame & (Frame::ColonFlag | Frame::TruncatedFlag)) {
+          note(JSONRepairCategory::MissingValue);
+          output += "null";
+        } else if (lenient) {
+          skipped(JSONRepairErrorCode::ColonExpected, i, i);
+          output += "null";
+        } else {
+          return fail(JSONRepairErrorCode::ColonExpected, i);
+        }
+      }
+      return continueObject(false);
+    default: // Frame::Call
+      emptyCall = emptyArgument;
+      frames.pop_back();
+      if (i < text.length() && text[i] == ')') {
+        i++;
+        if (i < text.length() && text[i] == ';') {
+          i++;
+        }
+      }
+      // A call in place of a key completes the key, not a value.
+      if (!frames.empty() && frames.back() == Frame::ObjectKey) {
+        return continueObjectAfterKey(true);
+      }
+      return true;
+    }
+  }
+
+  Outcome parseObject() {
+    if (i >= text.length() || text[i] != '{')
+      return Outcome::Rejected;
+    currentDepth++;
+    output += '{';
+    i++;
+    parseWhitespaceAndSkipComments();
+
+    if (skipCharacter(',')) {
+      note(JSONRepairCategory::RedundantComma);
+      parseWhitespaceAndSkipComments();
+    }
+    frames += Frame::ObjectValue;
+    return continueObject(true) ? Outcome::Parsed : Outcome::Pending;
+  }
+
+  // Runs the member loop of the object on top of `frames` up to the next
+  // value it needs; returns true when the object closed instead.
+  bool continueObject(bool initial) {
+    if (i >= text.length() || text[i] == '}')
+      return closeObject();
+
+    if (!initial) {
+      bool processedComma = parseCharacter(',');
+      if (!processedComma) {
+        note(JSONRepairCategory::MissingComma);
+        output.insertBeforeLastWhitespace(",");
+      }
+      parseWhitespaceAndSkipComments();
+    }
+
+    skipEllipsis();
+
+    Outcome key = parseString() ? Outcome::Parsed : parseUnquotedString(true);
+    if (key == Outcome::Pending) {
+      // The key is a function call, whose frame now sits on the object's:
+      // the object resumes with the key once the call is done.
+      frames[frames.size() - 2] = Frame::ObjectKey;
+      return false;
+    }
+    return continueObjectAfterKey(key == Outcome::Parsed);
+  }
+
+  bool continueObjectAfterKey(bool processedKey) {
+    if (!processedKey) {
+      if (i >= text.length() || text[i] == '}' || text[i] == '{' ||
+          text[i] == ']' || text[i] == '[') {
+        note(JSONRepairCategory::RedundantComma);
+        output.stripLastOccurrence(',');
+      } else if (lenient) {
+        return recoverObjectKey();
+      } else {
+        return fail(JSONRepairErrorCode::ObjectKeyExpected, i);
+      }
+      return closeObject();
+    }
+
+    parseWhitespaceAndSkipComments();
+    bool processedColon = parseCharacter(':');
+    bool truncated = i >= text.length();
+    if (!processedColon) {
+      if (isStartOfValue(i < text.length() ? text[i] : '\0') || truncated) {
+        note(JSONRepairCategory::MissingColon);
+        output.insertBeforeLastWhitespace(":");
+      } else if (lenient) {
+        // Skip to the value, or to the end of the member when there is
+        // none, which then repairs as a missing value.
+        size_t start = i;
+        while (i < text.length() && !isStartOfValue(text[i]) &&
+               text[i] != ',' && text[i] != '}') {
+          i++;
+        }
+        skipped(JSONRepairErrorCode::ColonExpected, start, i);
+        output.insertBeforeLastWhitespace(":");
+        processedColon = true;
+        truncated = i >= text.length();
+      } else {
+        return fail(JSONRepairErrorCode::ColonExpected, i);
+      }
+    }
+
+    frames.back() = static_cast<char>(Frame::ObjectValue |
+                                      (processedColon ? Frame::ColonFlag : 0) |
+                                      (truncated ? Frame::TruncatedFlag : 0));
+    return false;
+  }
+
+  // Lenient mode: the text at i cannot start a key. Up to the next
+  // delimiter or quote, it becomes the key when a colon follows, quoted, and
+  // is skipped otherwise, together with the comma after it.
+  bool recoverObjectKey() {
+    size_t start = i;
+    do {
+      i++;
+    } while (i < text.length() && !isDelimiter(text[i]) && !quoteAt(text, i));
+    size_t end = i;
+    while (end > start + 1 && isWhitespace(text[end - 1])) {
+      end--;
+    }
+    skipped(JSONRepairErrorCode::ObjectKeyExpected, start, end);
+
+    if (i < text.length() && text[i] == ':') {
+      output += '"';
+      for (size_t k = start; k < end; k++) {
+        CharT c = text[k];
+        if (c == '\\') {
+          output += "\\\\";
+        } else if (isControlCharacter(c)) {
+          output += charTable.controlEscapes[static_cast<size_t>(c)];
+        } else if (isValidStringCharacter(c)) {
+          output += c;
+        }
+      }
+      output += '"';
+      return continueObjectAfterKey(true);
+    }
+
+    parseWhitespaceAndSkipComments();
+    if (skipCharacter(',')) {
+      parseWhitespaceAndSkipComments();
+    }
+    if (i >= text.length() || text[i] == '}') {
+      output.stripTrailingComma();
+    }
+    return continueObject(true);
+  }
+
+  bool closeObject() {
+    frames.pop_back();
+    if (i < text.length() && text[i] == '}') {
+      output += '}';
+      i++;
+    } else {
+      note(JSONRepairCategory::MissingBracket);
+      output.insertBeforeLastWhitespace("}");
+    }
+    currentDepth--;
+    return true;
+  }
+
+  Outcome parseArray() {
+    if (i >= text.length() || text[i] != '[')
+      return Outcome::Rejected;
+    currentDepth++;
+    output += '[';
+    i++;
+    parseWhitespaceAndSkipComments();
+
+    if (skipCharacter(',')) {
+      note(JSONRepairCategory::RedundantComma);
+      parseWhitespaceAndSkipComments();
+    }
+    frames += Frame::Array;
+    return continueArray(true) ? Outcome::Parsed : Outcome::Pending;
+  }
+
+  // Like continueObject, for the elements of an array.
+  bool continueArray(bool initial) {
+    if (i >= text.length() || text[i] == ']')
+      return closeArray();
+
+    if (!initial) {
+      bool processedComma = parseCharacter(',');
+      if (!processedComma) {
+        note(JSONRepairCategory::MissingComma);
+        output.insertBeforeLastWhitespace(",");
+      }
+    }
+
+    skipEllipsis();
+    return false;
+  }
+
+  bool closeArray() {
+    frames.pop_back();
+    if (i < text.length() && text[i] == ']') {
+      output += ']';
+      i++;
+    } else {
+      note(JSONRepairCategory::MissingBracket);
+      output.insertBeforeLastWhitespace("]");
+    }
+    currentDepth--;
+    return true;
+  }
+
+  void parseNewlineDelimitedJSON() {
+    note(JSONRepairCategory::NewlineDelimited);
+    output.prepend("[\n");
+    parseDocuments(true);
+    output += "\n]";
+  }
+
+  // The documents of a sequence, the first of them too with `first`.
+  void parseDocuments(bool first) {
+    sequence = true;
+    while (i < text.length()) {
+      parseWhitespaceAndSkipComments();
+      if (i >= text.length() || !isStartOfValue(text[i]))
+        break;
+      if (!first) {
+        output += ",\n";
+      } else {
+        first = false;
+      }
+      if (!parseValue())
+        break;
+    }
+  }
+
+  // Repairs a quoted string in a single forward pass. Whenever the original
+  // algorithm would restart the string with stopAtDelimiter or stopAtIndex,
+  // the outcome of that second pass is already known from this one: it
+  // would process the same characters up to the first quote or delimiter
+  // (firstStop) or up to the comma before the current quote, and stop
+  // there. So str is cut back to that point and the loop resumes in the
+  // other mode instead of rescanning. Only strings opened with an escaped
+  // quote rescan, once, since the restarted pass no longer skips escapes.
+  bool parseString(bool stopAtDelimiter = false,
+                   size_t stopAtIndex = TextT::npos) {
+    bool skipEscapeChars = (i < text.length() && text[i] == '\\');
+    if (skipEscapeChars) {
+      note(JSONRepairCategory::StringEscape);
+      i++;
+    }
+
+    size_t quoteLength = i < text.length() ? quoteAt(text, i) : 0;
+    if (quoteLength == 0) {
+      return false;
+    }
+
+    auto isEndQuote = [&](size_t at) -> size_t {
+      if (Enc::doubleQuoteAt(text, i))
+        return Enc::doubleQuoteAt(text, at);
+      return Enc::singleQuoteAt(text, at); // 简化处理
+    };
+
+    if (text[i] != '"')
+      note(JSONRepairCategory::Quote);
+
+    size_t iBefore = i;
+    // The string is written straight into the output; retries truncate it.
+    size_t oBefore = output.length();
+    output += '"';
+    i += quoteLength;
+
+    // A plain scan from an earlier quote ran through this one and on to the
+    // end of the text, so this scan would too and then restart at the
+    // first delimiter: go straight to that.
+    if (!skipEscapeChars && stopAtIndex == TextT::npos &&
+        stringReachesEnd < iBefore && text[iBefore - 1] != '\\') {
+      stopAtDelimiter = true;
+    }
+
+    size_t firstStop = TextT::npos;
+    size_t firstStopLength = 0;
+    size_t top = TextT::npos;
+    size_t previousTop = TextT::npos;
+
+    while (true) {
+      if (!budget.step(output.length()))
+        return fail(budget.exceeded(), i);
+      previousTop = top;
+      top = i;
+      if (firstStop == TextT::npos &&
+          (i >= text.length() || isEndQuote(i) ||
+           isUnquotedStringDelimiter(text[i]))) {
+        firstStop = i;
+        firstStopLength = output.length();
+      }
+
+      if (i >= text.length()) {
+        size_t iPrev = prevNonWhitespaceIndex(Enc::previous(text, i));
+        if (!stopAtDelimiter && iPrev < text.length() &&
+            isDelimiter(text[iPrev])) {
+          reach = i;
+          if (skipEscapeChars) {
+            output.truncate(oBefore);
+            i = iBefore;
+            return parseString(true);
+          }
+          if (stopAtIndex == TextT::npos) {
+            stringReachesEnd = iBefore;
+          }
+          output.truncate(firstStopLength);
+          i = firstStop;
+          stopAtDelimiter = true;
+          continue;
+        }
+        note(JSONRepairCategory::MissingQuote);
+        output.insertBeforeLastWhitespace("\"");
+        return true;
+      }
+
+      if (i == stopAtIndex) {
+        note(JSONRepairCategory::MissingQuote);
+        output.insertBeforeLastWhitespace("\"");
+        return true;
+      }
+
+      if (size_t endQuoteLength = isEndQuote(i)) {
+        if (text[i] != '"')
+          note(JSONRepairCategory::Quote);
+        size_t iQuote = i;
+        size_t oQuote = output.length();
+        output += '"';
+        i += endQuoteLength;
+
+        // Look past whitespace and comments without keeping them yet.
+        size_t oPeek = output.length();
+        parseWhitespaceAndSkipComments(false);
+        output.truncate(oPeek);
+        reach = std::max(reach, i);
+
+        if (stopAtDelimiter || i >= text.length() ||
+            (i < text.length() &&
+             (isDelimiter(text[i]) || quoteAt(text, i) || isDigit(text[i])))) {
+          i = iQuote + endQuoteLength;
+          parseWhitespaceAndSkipComments(false);
+          parseConcatenatedString();
+          return true;
+        }
+
+        size_t iPrevchar =
+            prevNonWhitespaceIndex(Enc::previous(text, iQuote));
+        CharT prevchar =
+            (iPrevchar < text.length()) ? text[iPrevchar] : CharT();
+
+        if (prevchar == ',') {
+          if (skipEscapeChars) {
+            output.truncate(oBefore);
+            i = iBefore;
+            return parseString(false, iPrevchar);
+          }
+          // The comma right before the quote was a character of its own, so
+          // end the string there. (When it was swallowed by an escape
+          // sequence there is no such position; escape the quote instead.)
+          if (previousTop == iPrevchar) {
+            output.truncate(oQuote - 1);
+            i = iPrevchar;
+            stopAtIndex = iPrevchar;
+            continue;
+          }
+        } else if (isDelimiter(prevchar)) {
+          if (skipEscapeChars) {
+            output.truncate(oBefore);
+            i = iBefore;
+            return parseString(true);
+          }
+          output.truncate(firstStopLength);
+          i = firstStop;
+          stopAtDelimiter = true;
+          continue;
+        }
+
+        i = iQuote + endQuoteLength;
+        note(JSONRepairCategory::StringEscape);
+        output.insert(oQuote, '\\');
+        continue;
+      }
 
       if (stopAtDelimiter && isUnquotedStringDelimiter(text[i])) {
-        StringT urlTest =
-            (iBefore + 1 < i + 2 && iBefore + 1 < text.length())
-                ? text.substr(iBefore + 1,
-                              std::min(i + 2 - (iBefore + 1),
-                                       text.length() - (iBefore + 1)))
-                : u"";
-        if (i > 0 && text[i - 1] == ':' && isUrlStart(urlTest)) {
+        size_t content = iBefore + quoteLength;
+        if (i > 0 && text[i - 1] == ':' && content < text.length() &&
+            content < i + 2 &&
+            isUrlStart(text.begin() + content,
+                       text.begin() + std::min(i + 2, text.length()))) {
           while (i < text.length() && isUrlChar(text[i])) {
-            str += text[i];
+            output += text[i];
             i++;
           }
         }
-        str = insertBeforeLastWhitespace(str, u"\"");
-        output += str;
-        parseConcatenatedString();
-        return true;
+        note(JSONRepairCategory::MissingQuote);
+        output.insertBeforeLastWhitespace("\"");
+        parseConcatenatedString();
+        return true;
+      }
+
+      if (i < text.length() && text[i] == '\\') {
+        if (i + 1 >= text.length()) {
+          note(JSONRepairCategory::StringEscape);
+          i++;
+          continue;
+        }
+        CharT next = text[i + 1];
+        if (isEscapeCharacter(next)) {
+          output.append(text, i, 2);
+          i += 2;
+        } else if (next == 'u') {
+          int j = 2;
+          while (j < 6 && i + j < text.length() && isHex(text[i + j])) {
+            j++;
+          }
+          if (j == 6) {
+            output.append(text, i, 6);
+            i += 6;
+          } else if (i + j >= text.length()) {
+            note(JSONRepairCategory::StringEscape);
+            i = text.length();
+          } else {
+            return fail(JSONRepairErrorCode::InvalidUnicodeCharacter, i);
+          }
+        } else {
+          note(JSONRepairCategory::StringEscape);
+          output += next;
+          i += 2;
+        }
+        continue;
+      }
+
+      if (i < text.length()) {
+        CharT c = text[i];
+        if (c == '"' && (i == 0 || text[i - 1] != '\\')) {
+          note(JSONRepairCategory::StringEscape);
+          output += "\\\"";
+          i++;
+        } else if (isControlCharacter(c)) {
+          note(JSONRepairCategory::StringEscape);
+          output += charTable.controlEscapes[static_cast<size_t>(c)];
+          i++;
+        } else {
+          if (!isValidStringCharacter(c)) {
+            return fail(JSONRepairErrorCode::InvalidCharacter, i);
+          }
+          output += c;
+          i++;
+          // Copy the plain characters that follow in one go. Each of them
+          // would have taken an iteration of its own, the last one at end-1.
+          if (!skipEscapeChars) {
+            unsigned stops =
+                UnitClass::Quote | UnitClass::Backslash | UnitClass::Control;
+            if (firstStop == TextT::npos || stopAtDelimiter)
+              stops |= UnitClass::Delimiter;
+            size_t end = index.next(i, stops);
+            if (stopAtIndex >= i)
+              end = std::min(end, stopAtIndex);
+            if (end > i) {
+              output.append(text, i, end - i);
+              top = end - 1;
+              i = end;
+            }
+          }
+        }
+      }
+
+      // 防止死循环：确保 i 至少推进 1
+      if (i == iBefore) {
+        i++; // 强制推进，避免死循环
+      }
+
+      if (skipEscapeChars) {
+        skipEscapeCharacter();
+      }
+    }
+  }
+
+  // Joins `"a" + "b" + ...`. A string that ends in a chain calls this
+  // function again; the nested call only notes that and leaves the next
+  // '+' to the loop here, so a long chain does not nest on the native stack.
+  // Such a string's opening quote used to be removed after the rest of the
+  // chain, at the offset taken before it, so the removal is deferred. The
+  // last string of a chain is followed by no '+', and its quote goes at
+  // once, as it did.
+  bool parseConcatenatedString() {
+    bool processed = false;
+    parseWhitespaceAndSkipComments();
+    if (concatenating) {
+      chainContinues = i < text.length() && text[i] == '+';
+      return false;
+    }
+    concatenating = true;
+    while (i < text.length() && text[i] == '+') {
+      note(JSONRepairCategory::Concatenation);
+      processed = true;
+      i++;
+      parseWhitespaceAndSkipComments();
+      // 只移除最后一个引号，不移除后续内容
+      output.stripLastOccurrence('"');
+      size_t start = output.length();
+      chainContinues = false;
+      bool parsed = parseString();
+      if (parsed) {
+        // 移除开头的 "，因为 parseString 会加
+        if (chainContinues) {
+          deferredQuotes.push_back(start);
+        } else {
+          output.removeAtIndex(start, 1);
+        }
+      } else {
+        output.insertBeforeLastWhitespace("\"");
+      }
+    }
+    output.removeAtIndices(deferredQuotes);
+    deferredQuotes.clear();
+    concatenating = false;
+    return processed;
+  }
+
+  bool parseNumber() {
+    size_t start = i;
+    if (i < text.length() && text[i] == '-') {
+      i++;
+      if (i >= text.length() || (!isDigit(text[i]) && text[i] != '.')) {
+        note(JSONRepairCategory::Number);
+        output.append(text, start, i - start);
+        output += '0';
+        return true;
+      }
+    }
+
+    while (i < text.length() && isDigit(text[i])) {
+      i++;
+    }
+
+    if (i < text.length() && text[i] == '.') {
+      i++;
+      if (i >= text.length() || !isDigit(text[i])) {
+        note(JSONRepairCategory::Number);
+        output.append(text, start, i - start);
+        output += '0';
+        return true;
+      }
+      while (i < text.length() && isDigit(text[i])) {
+        i++;
+      }
+    }
+
+    if (i < text.length() && (text[i] == 'e' || text[i] == 'E')) {
+      i++;
+      if (i < text.length() && (text[i] == '+' || text[i] == '-')) {
+        i++;
+      }
+      if (i >= text.length() || !isDigit(text[i])) {
+        note(JSONRepairCategory::Number);
+        output.append(text, start, i - start);
+        output += '0';
+        return true;
+      }
+      while (i < text.length() && isDigit(text[i])) {
+        i++;
+      }
+    }
+
+    if (i >= text.length() || isDelimiter(text[i]) || isWhitespace(text[i])) {
+      if (i > start) {
+        bool hasInvalidLeadingZero =
+            i - start > 1 && text[start] == '0' && isDigit(text[start + 1]);
+        if (hasInvalidLeadingZero) {
+          note(JSONRepairCategory::Number, start);
+          output += '"';
+        }
+        output.append(text, start, i - start);
+        if (hasInvalidLeadingZero)
+          output += '"';
+        return true;
+      }
+    } else {
+      i = start;
+      return false;
+    }
+
+    return false;
+  }
+
+  bool parseKeywords() {
+    if (i >= text.length())
+      return false;
+    switch (text[i]) {
+    case 't':
+      return parseKeyword("true", "true");
+    case 'f':
+      return parseKeyword("false", "false");
+    case 'n':
+      return parseKeyword("null", "null");
+    case 'T':
+      return parseKeyword("True", "true");
+    case 'F':
+      return parseKeyword("False", "false");
+    case 'N':
+      return parseKeyword("None", "null");
+    default:
+      return false;
+    }
+  }
+
+  bool parseKeyword(const char *keyword, const char *value) {
+    if (matchesAt(i, keyword)) {
+      if (std::strcmp(keyword, value) != 0)
+        note(JSONRepairCategory::Keyword);
+      output += value;
+      i += std::strlen(keyword);
+      return true;
+    }
+    return false;
+  }
+
+  // A function call such as `NumberLong(2)` or a JSONP wrapper leaves a
+  // Call frame waiting for its argument and returns Pending.
+  Outcome parseUnquotedString(bool isKey) {
+    size_t start = i;
+    if (i < text.length() && isFunctionNameCharStart(text[i])) {
+      while (i < text.length() && isFunctionNameChar(text[i])) {
+        i++;
+      }
+      size_t j = i;
+      while (j < text.length() && isWhitespace(text[j])) {
+        j++;
+      }
+      if (j < text.length() && text[j] == '(') {
+        note(JSONRepairCategory::FunctionCall);
+        i = j + 1;
+        frames += Frame::Call;
+        return Outcome::Pending;
+      }
+    }
+
+    unsigned stops = UnitClass::Quote | UnitClass::Control |
+                     UnitClass::Delimiter | (isKey ? UnitClass::Colon : 0u);
+    while ((i = index.next(i, stops)) < text.length() &&
+           !isUnquotedStringDelimiter(text[i]) && !quoteAt(text, i) &&
+           (!isKey || text[i] != ':')) {
+      i++;
+    }
+
+    if (i > start && i > 0 && text[i - 1] == ':' && i + 2 <= text.length()) {
+      if (isUrlStart(text.begin() + start, text.begin() + i + 2)) {
+        while (i < text.length() && isUrlChar(text[i])) {
+          i++;
+        }
+      }
+    }
+
+    if (i > start) {
+      while (i > start && isWhitespace(text[i - 1])) {
+        i--;
+      }
+      if (i - start == 9 && matchesAt(start, "undefined")) {
+        note(JSONRepairCategory::Keyword, start);
+        output += "null";
+      } else {
+        note(JSONRepairCategory::UnquotedString, start);
+        output += '"';
+        for (size_t k = start; k < i; k++) {
+          if (text[k] == '"' || text[k] == '\\') {
+            output += '\\';
+          }
+          output += text[k];
+        }
+        output += '"';
+      }
+      if (i < text.length() && text[i] == '"') {
+        i++;
+      }
+      return Outcome::Parsed;
+    }
+    return Outcome::Rejected;
+  }
+
+  bool parseRegex() {
+    if (i < text.length() && text[i] == '/') {
+      size_t start = i;
+      i++;
+      while (i < text.length() &&
+             (text[i] != '/' || (i > 0 && text[i - 1] == '\\'))) {
+        i++;
+      }
+      if (i < text.length()) {
+        i++; // skip closing '/'
+      }
+      note(JSONRepairCategory::UnquotedString, start);
+      output += '"';
+      output.append(text, start, i - start);
+      output += '"';
+      return true;
+    }
+    return false;
+  }
+};
+
+// --- Strict validation ---
+
+// Whether a code unit can start a character the repair engine takes for a
+// quote, other than '"': ' ` and the curly quotes.
+template <typename CharT> static bool startsOtherQuote(CharT c) {
+  if constexpr (sizeof(CharT) == 1)
+    return c == '\'' || c == '`' || static_cast<unsigned char>(c) == 0xE2;
+  else
+    return c == '\'' || c == '`' || (c >= 0x2018 && c <= 0x201D);
+}
+
+// Index of the first code unit at or after `i` that interrupts plain string
+// content: a quote, a backslash or a control character, and with
+// `OtherQuotes` whatever startsOtherQuote. Byte sized code units are tested
+// 16 at a time where SSE2 is available.
+template <bool OtherQuotes = false, typename CharT>
+static size_t skipStringContent(const CharT *s, size_t i, size_t n) {
+  using UnitT = std::make_unsigned_t<CharT>;
+#if defined(JSONREPAIR_X86_SIMD) && defined(__SSE2__)
+  if constexpr (sizeof(CharT) == 1) {
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1F);
+    for (; i + 16 <= n; i += 16) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i));
+      __m128i stop = _mm_or_si128(
+          _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+          _mm_cmpeq_epi8(_mm_min_epu8(v, control), v));
+      if constexpr (OtherQuotes) {
+        stop = _mm_or_si128(
+            stop, _mm_or_si128(
+                      _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\'')),
+                                   _mm_cmpeq_epi8(v, _mm_set1_epi8('`'))),
+                      _mm_cmpeq_epi8(v, _mm_set1_epi8(char(0xE2)))));
+      }
+      int mask = _mm_movemask_epi8(stop);
+      if (mask != 0)
+        return i + static_cast<size_t>(countTrailingZeros(mask));
+    }
+  }
+#endif
+  while (i < n && s[i] != '"' && s[i] != '\\' &&
+         static_cast<UnitT>(s[i]) >= 0x20 &&
+         !(OtherQuotes && startsOtherQuote(s[i]))) {
+    i++;
+  }
+  return i;
+}
+
+// Accepts exactly the documents of RFC 8259 (with the same nesting limit as
+// the repair engine) so that they can be passed through untouched. Scanning
+// is iterative: the open containers are kept as a stack of '{' and '['.
+// Code units above ASCII are not checked for being well formed, the engine
+// copies those through unchanged as well. A Resumable validator also finds
+// where the engine can take over a text it rejects.
+template <typename CharT, typename Stack, bool Resumable>
+class Validator {
+public:
+  // Keeps the open containers in `stack`, which is emptied first. Given a
+  // budget, it counts a step per value, as the engine does, hands them to
+  // the budget every so often and at the end, and rejects the text where
+  // the budget runs out.
+  Validator(const CharT *text, size_t length, int maxDepth, Stack &stack,
+            Budget *budget = nullptr)
+      : s(text), n(length), maxDepth(maxDepth <= 0 ? 100 : maxDepth),
+        stack(stack), budget(budget) {
+    stack.clear();
+  }
+
+  // Where the validator stopped.
+  size_t position() const { return i; }
+
+  bool valid() {
+    skipWhitespace();
+    bool accepted = values(false);
+    return poll() && accepted;
+  }
+
+  // Resumable: reads on from the comma at `at`, after a value in a container
+  // opened with `open`, as valid() reads a document, and returns the resume
+  // position past it that valid() would have, or `at` when there is none
+  // before the container closes. The stack then starts with the container,
+  // which `maxDepth` counts.
+  size_t skipFrom(size_t at, CharT open) {
+    i = at;
+    stack.clear();
+    stack.push_back(static_cast<char>(open));
+    resumeAt = at;
+    depthAt = keptAt = 1;
+    values(true);
+    poll();
+    return resumeAt == static_cast<size_t>(-1) ? at : resumeAt;
+  }
+
+  // Resumable: the last comma or closing bracket passed, where a value
+  // inside the first resumeDepth() containers of the stack had just ended,
+  // or the start of a string value after it; npos when there is none. The
+  // engine repairs the text before it into itself, as it is valid JSON so
+  // far and has no string the engine would read differently, so a rejected
+  // text can be repaired from there on. The stack keeps those containers,
+  // except the innermost one when the bracket there closed it.
+  size_t resumePosition() const { return resumeAt; }
+  size_t resumeDepth() const { return depthAt; }
+  bool resumeAfterValue() const { return endedAt; }
+
+private:
+  const CharT *s;
+  size_t n;
+  size_t i = 0;
+  int maxDepth;
+  Stack &stack;
+  Budget *budget;
+  // Steps not yet handed to the budget.
+  unsigned unpolled = 0;
+  size_t resumeAt = static_cast<size_t>(-1);
+  size_t depthAt = 0;
+  bool endedAt = true;
+  // How many containers at the bottom of the stack the resume reads.
+  size_t keptAt = 0;
+  // A string so far had a character the engine takes for a quote, which
+  // may end the string early there. The resume point stays before it, and
+  // is dropped once a container it reads is closed.
+  bool otherQuotes = false;
+
+  // The values from the cursor on, or what follows the value that just
+  // ended there.
+  bool values(bool ended) {
+    for (;;) {
+      if (++unpolled == 1024 && !poll())
+        return false;
+      if (ended) {
+        ended = false;
+      } else if (stack.size() > static_cast<size_t>(maxDepth)) {
+        return false;
+      } else if (i < n && (s[i] == '{' || s[i] == '[')) {
+        CharT open = s[i++];
+        skipWhitespace();
+        if (i < n && s[i] == (open == '{' ? '}' : ']')) {
+          i++;
+        } else {
+          stack.push_back(static_cast<char>(open));
+          if (open == '{' && !member())
+            return false;
+          continue;
+        }
+      } else {
+        if constexpr (Resumable) {
+          // A truncated string can be long: resume at its start.
+          if (i < n && s[i] == '"' && !stack.empty())
+            checkpoint(false, false);
+        }
+        if (!scalar())
+          return false;
+      }
+
+      // After a value: close containers until a comma asks for the next one.
+      for (;;) {
+        skipWhitespace();
+        if (stack.empty())
+          return i == n;
+        if (i >= n)
+          return false;
+        if (s[i] == ',') {
+          checkpoint(false, true);
+          i++;
+          skipWhitespace();
+          if (stack.back() == '{' && !member())
+            return false;
+          break;
+        }
+        if (s[i] != (stack.back() == '{' ? '}' : ']'))
+          return false;
+        checkpoint(true, true);
+        stack.pop_back();
+        i++;
+      }
+    }
+  }
+
+  bool poll() {
+    unsigned count = unpolled;
+    unpolled = 0;
+    return !budget || budget->advance(count);
+  }
+
+  void checkpoint(bool closing, bool ended) {
+    if constexpr (Resumable) {
+      if (!otherQuotes) {
+        resumeAt = i;
+        depthAt = stack.size();
+        endedAt = ended;
+        keptAt = closing ? depthAt - 1 : depthAt;
+      } else if (closing && stack.size() <= keptAt) {
+        resumeAt = static_cast<size_t>(-1);
+      }
+    }
+  }
+
+  bool otherQuoteAt(size_t k) const {
+    if constexpr (sizeof(CharT) == 1) {
+      auto byte = [&](size_t at) {
+        return at < n ? static_cast<unsigned char>(s[at]) : 0;
+      };
+      return s[k] == '\'' || s[k] == '`' ||
+             (byte(k) == 0xE2 && byte(k + 1) == 0x80 &&
+              (byte(k + 2) == 0x98 || byte(k + 2) == 0x99 ||
+               byte(k + 2) == 0x9C || byte(k + 2) == 0x9D));
+    } else {
+      return s[k] != '"' && (isDoubleQuote(s[k]) || isSingleQuote(s[k]));
+    }
+  }
+
+  void skipWhitespace() {
+    while (i < n &&
+           (s[i] == ' ' || s[i] == '\n' || s[i] == '\r' || s[i] == '\t')) {
+      i++;
+    }
+  }
+
+  // A key and its colon, leaving the cursor at the value.
+  bool member() {
+    if (!string())
+      return false;
+    skipWhitespace();
+    if (i >= n || s[i] != ':')
+      return false;
+    i++;
+    skipWhitespace();
+    return true;
+  }
+
+  bool scalar() {
+    if (i >= n)
+      return false;
+    switch (s[i]) {
+    case '"':
+      return string();
+    case 't':
+      return literal("true");
+    case 'f':
+      return literal("false");
+    case 'n':
+      return literal("null");
+    default:
+      return number();
+    }
+  }
+
+  bool literal(const char *word) {
+    size_t length = std::strlen(word);
+    if (n - i < length || !std::equal(word, word + length, s + i))
+      return false;
+    i += length;
+    return true;
+  }
+
+  bool string() {
+    if (i >= n || s[i] != '"')
+      return false;
+    i++;
+    for (;;) {
+      i = skipStringContent<Resumable>(s, i, n);
+      if constexpr (Resumable) {
+        if (i < n && startsOtherQuote(s[i])) {
+          otherQuotes = otherQuotes || otherQuoteAt(i);
+          i++;
+          continue;
+        }
+      }
+      if (i >= n || s[i] != '\\')
+        break;
+      if (i + 1 >= n)
+        return false;
+      switch (s[i + 1]) {
+      case '"':
+      case '\\':
+      case '/':
+      case 'b':
+      case 'f':
+      case 'n':
+      case 'r':
+      case 't':
+        i += 2;
+        break;
+      case 'u':
+        if (n - i < 6 || !std::all_of(s + i + 2, s + i + 6, isHex))
+          return false;
+        i += 6;
+        break;
+      default:
+        return false;
+      }
+    }
+    if (i >= n || s[i] != '"')
+      return false;
+    i++;
+    return true;
+  }
+
+  bool digits() {
+    size_t start = i;
+    while (i < n && isDigit(s[i])) {
+      i++;
+    }
+    return i > start;
+  }
+
+  bool number() {
+    if (i < n && s[i] == '-')
+      i++;
+    if (i < n && s[i] == '0') {
+      i++;
+    } else if (!digits()) {
+      return false;
+    }
+    if (i < n && s[i] == '.') {
+      i++;
+      if (!digits())
+        return false;
+    }
+    if (i < n && (s[i] == 'e' || s[i] == 'E')) {
+      i++;
+      if (i < n && (s[i] == '+' || s[i] == '-'))
+        i++;
+      if (!digits())
+        return false;
+    }
+    return true;
+  }
+};
+
+// Whether `text` is valid JSON, read under `budget`, which the repair then
+// goes on with. A budget that runs out first is reported in `status`.
+template <typename CharT, typename Stack>
+static bool isValidJson(std::basic_string_view<CharT> text, int maxDepth,
+                        Stack &stack, Budget &budget,
+                        JSONRepairStatus &status) {
+  Validator<CharT, Stack> validator(text.data(), text.length(), maxDepth,
+                                    stack, &budget);
+  if (validator.valid())
+    return true;
+  if (budget.exceeded() != JSONRepairErrorCode::None)
+    status = failure(budget.exceeded(), validator.position());
+  return false;
+}
+
+// Repairs `text` in `buffers`. Text that is valid JSON already is left
+// alone and `valid` set; otherwise a successful repair leaves the document
+// in buffers.output. A lenient repair lists what it skipped in
+// `unrecoverable`, when given.
+template <typename CharT, typename Alloc>
+static JSONRepairStatus
+repairIn(RepairBuffers<CharT, Alloc> &buffers,
+         std::basic_string_view<CharT> text, const JSONRepairOptions &options,
+         bool &valid, std::vector<JSONRepairSpan> *unrecoverable = nullptr) {
+  valid = false;
+  if (!fitsInput(options, text.length()))
+    return failure(JSONRepairErrorCode::InputSizeLimit, 0);
+  Budget budget(options, text.length());
+  JSONRepairStatus status;
+  if (isValidJson(text, options.maxDepth, buffers.validatorStack, budget,
+                  status)) {
+    valid = true;
+    return {};
+  }
+  if (!status)
+    return status;
+  return Parser<CharT, Alloc>(text, options, buffers, unrecoverable, nullptr,
+                              &budget)
+      .parse();
+}
+
+// Runs the engine over `text` without building the output, starting where
+// the validator gave up when it can.
+template <typename CharT>
+static JSONRepairAnalysis analyze(std::basic_string_view<CharT> text,
+                                  const JSONRepairOptions &options) {
+  JSONRepairAnalysis analysis;
+  if (!fitsInput(options, text.length())) {
+    static_cast<JSONRepairStatus &>(analysis) =
+        failure(JSONRepairErrorCode::InputSizeLimit, 0);
+    return analysis;
+  }
+  RepairBuffers<CharT> buffers;
+  Budget budget(options, text.length());
+  Validator<CharT, typename RepairBuffers<CharT>::Stack, true> validator(
+      text.data(), text.length(), options.maxDepth, buffers.validatorStack,
+      &budget);
+  if (validator.valid())
+    return analysis;
+  if (budget.exceeded() != JSONRepairErrorCode::None) {
+    static_cast<JSONRepairStatus &>(analysis) =
+        failure(budget.exceeded(), validator.position());
+    return analysis;
+  }
+  size_t resumeAt = validator.resumePosition();
+  Parser<CharT, std::allocator<CharT>, NullOutput<CharT>> parser(
+      text, options, buffers, nullptr, &analysis, &budget);
+  static_cast<JSONRepairStatus &>(analysis) =
+      resumeAt == std::basic_string_view<CharT>::npos
+          ? parser.parse()
+          : parser.parseFrom(resumeAt, buffers.validatorStack,
+                             validator.resumeDepth(),
+                             validator.resumeAfterValue());
+  return analysis;
+}
+
+// Repairs `text` as a cut and an append. The engine starts where the
+// validator gave up, writing after a short window of the text before, and
+// the cut goes where it first edited that window; when an edit might have
+// reached past the window, the whole text is repaired instead.
+template <typename CharT>
+static JSONRepairCompletion<std::basic_string<CharT>>
+complete(std::basic_string_view<CharT> text,
+         const JSONRepairOptions &options) {
+  constexpr size_t Window = 64;
+  JSONRepairCompletion<std::basic_string<CharT>> result;
+  if (!fitsInput(options, text.length())) {
+    static_cast<JSONRepairStatus &>(result) =
+        failure(JSONRepairErrorCode::InputSizeLimit, 0);
+    return result;
+  }
+  RepairBuffers<CharT> buffers;
+  Budget budget(options, text.length());
+  Validator<CharT, typename RepairBuffers<CharT>::Stack, true> validator(
+      text.data(), text.length(), options.maxDepth, buffers.validatorStack,
+      &budget);
+  if (validator.valid()) {
+    result.keep = text.length();
+    return result;
+  }
+  if (budget.exceeded() != JSONRepairErrorCode::None) {
+    static_cast<JSONRepairStatus &>(result) =
+        failure(budget.exceeded(), validator.position());
+    return result;
+  }
+  size_t resumeAt = validator.resumePosition();
+  if (resumeAt != std::basic_string_view<CharT>::npos) {
+    size_t base = resumeAt - std::min(resumeAt, Window);
+    size_t edited;
+    bool reachedStart;
+    buffers.output.assign(text, base, resumeAt - base);
+    {
+      Parser<CharT, std::allocator<CharT>, ResumedOutput<CharT>> parser(
+          text, options, buffers, nullptr, nullptr, &budget);
+      static_cast<JSONRepairStatus &>(result) = parser.parseFrom(
+          resumeAt, buffers.validatorStack, validator.resumeDepth(),
+          validator.resumeAfterValue());
+      edited = std::min(parser.written().edited(), resumeAt - base);
+      reachedStart = parser.written().reachedStart();
+    }
+    if (!result)
+      return result;
+    if (base == 0 || !reachedStart) {
+      // Whatever of the output repeats the text goes into the cut too.
+      const std::basic_string<CharT> &output = buffers.output;
+      size_t keep = base + edited;
+      size_t same = edited;
+      while (keep < text.length() && same < output.length() &&
+             output[same] == text[keep]) {
+        keep++;
+        same++;
       }
+      result.keep = keep;
+      result.suffix.assign(output, same, std::basic_string<CharT>::npos);
+      return result;
+    }
+  }
+  static_cast<JSONRepairStatus &>(result) =
+      Parser<CharT>(text, options, buffers, nullptr, nullptr, &budget).parse();
+  if (result)
+    result.suffix = std::move(buffers.output);
+  return result;
+}
+
+// Repairs `text` into the edits that make it the repaired document, without
+// building that document.
+template <typename CharT>
+static JSONRepairEdits<std::basic_string<CharT>>
+editsOf(std::basic_string_view<CharT> text,
+        const JSONRepairOptions &options) {
+  JSONRepairEdits<std::basic_string<CharT>> result;
+  if (!fitsInput(options, text.length())) {
+    static_cast<JSONRepairStatus &>(result) =
+        failure(JSONRepairErrorCode::InputSizeLimit, 0);
+    return result;
+  }
+  RepairBuffers<CharT> buffers;
+  Budget budget(options, text.length());
+  if (isValidJson(text, options.maxDepth, buffers.validatorStack, budget,
+                  result) ||
+      !result)
+    return result;
+  Parser<CharT, std::allocator<CharT>, EditOutput<CharT>> parser(
+      text, options, buffers, nullptr, nullptr, &budget);
+  static_cast<JSONRepairStatus &>(result) = parser.parse();
+  if (result)
+    parser.written().edits(result.edits);
+  return result;
+}
+
+// Makes `changes`, in text order, in the storage of `text`. Each run of
+// text between them moves once, those that move on in a pass from the back
+// and those that move back in a pass from the front, so that none lands on
+// one yet to move. The inserted text goes in last, between them.
+template <typename CharT>
+static void applyInPlace(std::basic_string<CharT> &text,
+                         const std::vector<TextChange> &changes,
+                         const std::basic_string<CharT> &inserted) {
+  using Traits = std::char_traits<CharT>;
+  size_t length = text.length();
+  size_t added = inserted.length();
+  size_t removed = 0;
+  for (const TextChange &change : changes) {
+    removed += change.length;
+  }
+  size_t repaired = length + added - removed;
+  if (repaired > length)
+    text.resize(repaired);
+  CharT *s = &text[0];
+  // The run after change k and where it starts in the text; `added` and
+  // `removed` count the changes up to k.
+  auto run = [&](size_t k, size_t &from) {
+    from = changes[k].offset + changes[k].length;
+    return (k + 1 < changes.size() ? changes[k + 1].offset : length) - from;
+  };
+  size_t from;
+  for (size_t k = changes.size(); k > 0; k--) {
+    size_t count = run(k - 1, from);
+    if (added > removed)
+      Traits::move(s + from + added - removed, s + from, count);
+    added -= changes[k - 1].count;
+    removed -= changes[k - 1].length;
+  }
+  for (size_t k = 0; k < changes.size(); k++) {
+    added += changes[k].count;
+    removed += changes[k].length;
+    size_t count = run(k, from);
+    if (added < removed)
+      Traits::move(s + from + added - removed, s + from, count);
+  }
+  added = 0;
+  removed = 0;
+  for (const TextChange &change : changes) {
+    Traits::copy(s + change.offset + added - removed, inserted.data() + added,
+                 change.count);
+    added += change.count;
+    removed += change.length;
+  }
+  if (repaired < length)
+    text.resize(repaired);
+}
+
+// A large output that outgrew the room the parser gave it has doubled, and
+// may have as much again unused. The result hands that back rather than
+// hold it for as long as the caller keeps the document; the copy needs no
+// more memory than the doubling did.
+template <typename StringT> static void releaseSlack(StringT &out) {
+  size_t unused = out.capacity() - out.length();
+  if (unused > out.length() / 8 && unused > (size_t(1) << 20))
+    out.shrink_to_fit();
+}
+
+// Stores the repaired `text`, or `text` itself when it is valid, in `out`,
+// whose allocator the repair uses throughout.
+template <typename CharT, typename Alloc>
+static JSONRepairStatus
+repairTo(std::basic_string<CharT, std::char_traits<CharT>, Alloc> &out,
+         std::basic_string_view<CharT> text,
+         const JSONRepairOptions &options,
+         std::vector<JSONRepairSpan> *unrecoverable = nullptr) {
+  RepairBuffers<CharT, Alloc> buffers(out.get_allocator());
+  bool valid;
+  JSONRepairStatus status =
+      repairIn(buffers, text, options, valid, unrecoverable);
+  if (valid) {
+    out.assign(text.data(), text.length());
+  } else if (status) {
+    out = std::move(buffers.output);
+    releaseSlack(out);
+  }
+  return status;
+}
+
+template <typename CharT, typename Alloc = std::allocator<CharT>>
+static std::basic_string<CharT, std::char_traits<CharT>, Alloc>
+repair(std::basic_string_view<CharT> text, const JSONRepairOptions &options,
+       const Alloc &alloc = Alloc()) {
+  std::basic_string<CharT, std::char_traits<CharT>, Alloc> out(alloc);
+  JSONRepairStatus status = repairTo(out, text, options);
+  if (!status)
+    raise(status, text);
+  return out;
+}
+
+// Repairs `text` in its own storage, which the result takes over. When the
+// repair makes so many edits that they would take more memory than about a
+// quarter of the text, it is built as a new string instead, which then
+// replaces the text.
+template <typename CharT>
+static std::basic_string<CharT>
+repairInPlace(std::basic_string<CharT> &&text,
+              const JSONRepairOptions &options) {
+  if (!fitsInput(options, text.length()))
+    raise<CharT>(failure(JSONRepairErrorCode::InputSizeLimit, 0), text);
+  RepairBuffers<CharT> buffers;
+  Budget budget(options, text.length());
+  JSONRepairStatus status;
+  if (isValidJson<CharT>(text, options.maxDepth, buffers.validatorStack,
+                         budget, status))
+    return std::move(text);
+  if (!status)
+    raise<CharT>(status, text);
+  std::vector<TextChange> changes;
+  std::basic_string<CharT> inserted;
+  {
+    Parser<CharT, std::allocator<CharT>, EditOutput<CharT>> parser(
+        text, options, buffers, nullptr, nullptr, &budget);
+    parser.written().limit();
+    status = parser.parse();
+    if (status)
+      parser.written().changes(changes, inserted);
+  }
+  // Only the limit above stops an edit output, with WriteFailed.
+  if (status.error == JSONRepairErrorCode::WriteFailed) {
+    text = repair<CharT>(text, options);
+    return std::move(text);
+  }
+  if (!status)
+    raise<CharT>(status, text);
+  applyInPlace(text, changes, inserted);
+  return std::move(text);
+}
+
+template <typename CharT>
+static JSONRepairResult<std::basic_string<CharT>>
+tryRepair(std::basic_string_view<CharT> text,
+          const JSONRepairOptions &options) {
+  JSONRepairResult<std::basic_string<CharT>> result;
+  static_cast<JSONRepairStatus &>(result) =
+      repairTo(result.output, text, options, &result.unrecoverable);
+  if (!result)
+    result.unrecoverable.clear();
+  return result;
+}
+
+template <typename CharT>
+static bool repairIfNeeded(std::basic_string_view<CharT> text,
+                           std::basic_string<CharT> &repaired,
+                           const JSONRepairOptions &options) {
+  RepairBuffers<CharT> buffers;
+  bool valid;
+  JSONRepairStatus status = repairIn(buffers, text, options, valid);
+  if (valid)
+    return false;
+  if (!status)
+    raise(status, text);
+  repaired = std::move(buffers.output);
+  releaseSlack(repaired);
+  return true;
+}
+
+// Appends the repair of `text` to `out`, working in `buffers`.
+template <typename CharT>
+static JSONRepairStatus repairAppending(std::basic_string_view<CharT> text,
+                                        std::basic_string<CharT> &out,
+                                        const JSONRepairOptions &options,
+                                        RepairBuffers<CharT> &buffers) {
+  bool valid;
+  JSONRepairStatus status = repairIn(buffers, text, options, valid);
+  if (valid) {
+    out.append(text);
+  } else if (status) {
+    out.append(buffers.output);
+  }
+  return status;
+}
+
+// Repairs `text` into `sink`, which is given the output in parts as the
+// parser settles them.
+template <typename CharT>
+static JSONRepairStatus repairInto(std::basic_string_view<CharT> text,
+                                   JSONRepairSink<CharT> &sink,
+                                   const JSONRepairOptions &options) {
+  if (!fitsInput(options, text.length()))
+    return failure(JSONRepairErrorCode::InputSizeLimit, 0);
+  RepairBuffers<CharT> buffers;
+  Budget budget(options, text.length());
+  JSONRepairStatus status;
+  if (isValidJson(text, options.maxDepth, buffers.validatorStack, budget,
+                  status)) {
+    if (!sink.write(text.data(), text.length()))
+      return failure(JSONRepairErrorCode::WriteFailed, 0);
+    return {};
+  }
+  if (!status)
+    return status;
+  Parser<CharT, std::allocator<CharT>, SinkOutput<CharT>> parser(
+      text, options, buffers, nullptr, nullptr, &budget);
+  parser.written().to(sink);
+  status = parser.parse();
+  if (status && !parser.written().flush())
+    return failure(JSONRepairErrorCode::WriteFailed, text.length());
+  return status;
+}
+
+static JSONRepairOptions depthOnly(int maxDepth) {
+  JSONRepairOptions options;
+  options.maxDepth = maxDepth;
+  return options;
+}
+
+// --- Public entry points ---
+std::string jsonrepair(std::string_view text, int maxDepth) {
+  return repair(text, depthOnly(maxDepth));
+}
+
+std::string jsonrepair(std::string_view text,
+                       const JSONRepairOptions &options) {
+  return repair(text, options);
+}
+
+bool jsonrepair(std::string_view text, std::string &repaired, int maxDepth) {
+  return repairIfNeeded(text, repaired, depthOnly(maxDepth));
+}
+
+bool jsonrepair(std::string_view text, std::string &repaired,
+                const JSONRepairOptions &options) {
+  return repairIfNeeded(text, repaired, options);
+}
+
+std::u16string jsonrepair(std::u16string_view text, int maxDepth) {
+  return repair(text, depthOnly(maxDepth));
+}
+
+std::u16string jsonrepair(std::u16string_view text,
+                          const JSONRepairOptions &options) {
+  return repair(text, options);
+}
+
+bool jsonrepair(std::u16string_view text, std::u16string &repaired,
+                int maxDepth) {
+  return repairIfNeeded(text, repaired, depthOnly(maxDepth));
+}
+
+bool jsonrepair(std::u16string_view text, std::u16string &repaired,
+                const JSONRepairOptions &options) {
+  return repairIfNeeded(text, repaired, options);
+}
+
+std::u32string jsonrepair(std::u32string_view text, int maxDepth) {
+  return repair(text, depthOnly(maxDepth));
+}
+
+std::u32string jsonrepair(std::u32string_view text,
+                          const JSONRepairOptions &options) {
+  return repair(text, options);
+}
+
+bool jsonrepair(std::u32string_view text, std::u32string &repaired,
+                int maxDepth) {
+  return repairIfNeeded(text, repaired, depthOnly(maxDepth));
+}
+
+bool jsonrepair(std::u32string_view text, std::u32string &repaired,
+                const JSONRepairOptions &options) {
+  return repairIfNeeded(text, repaired, options);
+}
+
+JSONRepairResult<std::string> jsonrepair(std::string_view text,
+                                         const std::nothrow_t &,
+                                         const JSONRepairOptions &options) {
+  return tryRepair(text, options);
+}
+
+JSONRepairResult<std::u16string> jsonrepair(std::u16string_view text,
+                                            const std::nothrow_t &,
+                                            const JSONRepairOptions &options) {
+  return tryRepair(text, options);
+}
+
+JSONRepairResult<std::u32string> jsonrepair(std::u32string_view text,
+                                            const std::nothrow_t &,
+                                            const JSONRepairOptions &options) {
+  return tryRepair(text, options);
+}
+
+JSONRepairAnalysis jsonanalyze(std::string_view text,
+                               const JSONRepairOptions &options) {
+  return analyze(text, options);
+}
+
+JSONRepairAnalysis jsonanalyze(std::u16string_view text,
+                               const JSONRepairOptions &options) {
+  return analyze(text, options);
+}
+
+JSONRepairAnalysis jsonanalyze(std::u32string_view text,
+                               const JSONRepairOptions &options) {
+  return analyze(text, options);
+}
+
+JSONRepairCompletion<std::string>
+jsoncomplete(std::string_view text, const JSONRepairOptions &options) {
+  return complete(text, options);
+}
+
+JSONRepairCompletion<std::u16string>
+jsoncomplete(std::u16string_view text, const JSONRepairOptions &options) {
+  return complete(text, options);
+}
+
+JSONRepairCompletion<std::u32string>
+jsoncomplete(std::u32string_view text, const JSONRepairOptions &options) {
+  return complete(text, options);
+}
+
+JSONRepairEdits<std::string> jsonedits(std::string_view text,
+                                       const JSONRepairOptions &options) {
+  return editsOf(text, options);
+}
+
+JSONRepairEdits<std::u16string> jsonedits(std::u16string_view text,
+                                          const JSONRepairOptions &options) {
+  return editsOf(text, options);
+}
+
+JSONRepairEdits<std::u32string> jsonedits(std::u32string_view text,
+                                          const JSONRepairOptions &options) {
+  return editsOf(text, options);
+}
+
+JSONRepairStatus jsonrepair(std::string_view text, JSONRepairSink<char> &sink,
+                            const JSONRepairOptions &options) {
+  return repairInto(text, sink, options);
+}
+
+JSONRepairStatus jsonrepair(std::u16string_view text,
+                            JSONRepairSink<char16_t> &sink,
+                            const JSONRepairOptions &options) {
+  return repairInto(text, sink, options);
+}
+
+JSONRepairStatus jsonrepair(std::u32string_view text,
+                            JSONRepairSink<char32_t> &sink,
+                            const JSONRepairOptions &options) {
+  return repairInto(text, sink, options);
+}
+
+bool JSONRepairOstreamSink::write(const char *data, size_t length) {
+  return static_cast<bool>(
+      out.write(data, static_cast<std::streamsize>(length)));
+}
+
+#if __has_include(<unistd.h>)
+bool JSONRepairFdSink::write(const char *data, size_t length) {
+  while (length > 0) {
+    ssize_t count = ::write(fd, data, length);
+    if (count < 0 && errno == EINTR)
+      continue;
+    if (count <= 0)
+      return false;
+    data += count;
+    length -= static_cast<size_t>(count);
+  }
+  return true;
+}
+#endif
+
+std::string jsonrepair(std::string &&text, int maxDepth) {
+  return repairInPlace(std::move(text), depthOnly(maxDepth));
+}
+
+std::string jsonrepair(std::string &&text, const JSONRepairOptions &options) {
+  return repairInPlace(std::move(text), options);
+}
+
+std::u16string jsonrepair(std::u16string &&text, int maxDepth) {
+  return repairInPlace(std::move(text), depthOnly(maxDepth));
+}
+
+std::u16string jsonrepair(std::u16string &&text,
+                          const JSONRepairOptions &options) {
+  return repairInPlace(std::move(text), options);
+}
+
+std::u32string jsonrepair(std::u32string &&text, int maxDepth) {
+  return repairInPlace(std::move(text), depthOnly(maxDepth));
+}
+
+std::u32string jsonrepair(std::u32string &&text,
+                          const JSONRepairOptions &options) {
+  return repairInPlace(std::move(text), options);
+}
+
+std::string jsonrepair(const char *text, int maxDepth) {
+  return repair(std::string_view(text), depthOnly(maxDepth));
+}
+
+std::string jsonrepair(const char *text, const JSONRepairOptions &options) {
+  return repair(std::string_view(text), options);
+}
+
+std::u16string jsonrepair(const char16_t *text, int maxDepth) {
+  return repair(std::u16string_view(text), depthOnly(maxDepth));
+}
+
+std::u16string jsonrepair(const char16_t *text,
+                          const JSONRepairOptions &options) {
+  return repair(std::u16string_view(text), options);
+}
+
+std::u32string jsonrepair(const char32_t *text, int maxDepth) {
+  return repair(std::u32string_view(text), depthOnly(maxDepth));
+}
+
+std::u32string jsonrepair(const char32_t *text,
+                          const JSONRepairOptions &options) {
+  return repair(std::u32string_view(text), options);
+}
 
-      if (i < text.length() && text[i] == '\\') {
-        if (i + 1 >= text.length()) {
+#if defined(__cpp_lib_memory_resource)
+std::pmr::string jsonrepair(std::string_view text,
+                            std::pmr::memory_resource *resource,
+                            const JSONRepairOptions &options) {
+  return repair(text, options, std::pmr::polymorphic_allocator<char>(resource));
+}
+
+std::pmr::u16string jsonrepair(std::u16string_view text,
+                               std::pmr::memory_resource *resource,
+                               const JSONRepairOptions &options) {
+  return repair(text, options,
+                std::pmr::polymorphic_allocator<char16_t>(resource));
+}
+
+std::pmr::u32string jsonrepair(std::u32string_view text,
+                               std::pmr::memory_resource *resource,
+                               const JSONRepairOptions &options) {
+  return repair(text, options,
+                std::pmr::polymorphic_allocator<char32_t>(resource));
+}
+#endif
+
+// --- JSONRepairer ---
+struct JSONRepairer::Buffers {
+  RepairBuffers<char> utf8;
+  RepairBuffers<char16_t> utf16;
+  RepairBuffers<char32_t> utf32;
+};
+
+JSONRepairer::JSONRepairer(const JSONRepairOptions &options)
+    : options(options), buffers(new Buffers) {}
+
+JSONRepairer::~JSONRepairer() = default;
+JSONRepairer::JSONRepairer(JSONRepairer &&) noexcept = default;
+JSONRepairer &JSONRepairer::operator=(JSONRepairer &&) noexcept = default;
+
+void JSONRepairer::repair(std::string_view text, std::string &out) {
+  if (JSONRepairStatus status = repair(text, out, std::nothrow); !status)
+    raise(status, text);
+}
+
+JSONRepairStatus JSONRepairer::repair(std::string_view text,
+                                      std::string &out,
+                                      const std::nothrow_t &) {
+  return repairAppending(text, out, options, buffers->utf8);
+}
+
+void JSONRepairer::repair(std::u16string_view text, std::u16string &out) {
+  if (JSONRepairStatus status = repair(text, out, std::nothrow); !status)
+    raise(status, text);
+}
+
+JSONRepairStatus JSONRepairer::repair(std::u16string_view text,
+                                      std::u16string &out,
+                                      const std::nothrow_t &) {
+  return repairAppending(text, out, options, buffers->utf16);
+}
+
+void JSONRepairer::repair(std::u32string_view text, std::u32string &out) {
+  if (JSONRepairStatus status = repair(text, out, std::nothrow); !status)
+    raise(status, text);
+}
+
+JSONRepairStatus JSONRepairer::repair(std::u32string_view text,
+                                      std::u32string &out,
+                                      const std::nothrow_t &) {
+  return repairAppending(text, out, options, buffers->utf32);
+}
+
+std::string_view JSONRepairer::repairBytes(std::string_view text) {
+  std::string_view repaired;
+  if (JSONRepairStatus status = repairBytes(text, repaired, std::nothrow);
+      !status)
+    raise(status, text);
+  return repaired;
+}
+
+JSONRepairStatus JSONRepairer::repairBytes(std::string_view text,
+                                           std::string_view &repaired,
+                                           const std::nothrow_t &) {
+  bool valid;
+  JSONRepairStatus status = repairIn(buffers->utf8, text, options, valid);
+  if (valid) {
+    repaired = text;
+  } else if (status) {
+    repaired = buffers->utf8.output;
+  }
+  return status;
+}
+
+// --- JSONRepairStream ---
+
+// Reads a document piece by piece through the grammar of Validator, stopping
+// where the text ends and going on from there once more of it arrives. It
+// keeps the open containers and what the text read so far lacks to be valid
+// JSON; once the text can no longer become valid JSON it reads no further.
+// A leading markdown code fence is passed over, as the engine drops it.
+struct StreamScanner {
+  using Stack = RepairBuffers<char>::Stack;
+
+  enum class State : uint8_t {
+    Start,      // at the beginning
+    Fence,      // in a leading code fence or the language name after it
+    Value,      // before a value
+    FirstValue, // before the first value of an array, or its ']'
+    Key,        // before an object key
+    FirstKey,   // before the first key of an object, or its '}'
+    Colon,      // after an object key
+    String,     // in a string, a key when `key` is set
+    Escape,     // after a backslash in a string
+    Unicode,    // in the hex digits of a \u escape
+    Number,     // in a number, at `number`
+    Literal,    // in true, false or null
+    After,      // after a value
+    Invalid,    // past the point where the text stopped being JSON
+  };
+
+  // The parts of a number, named after what was read last.
+  enum class NumberPart : uint8_t {
+    Minus, Zero, Integer, Dot, Fraction, Exponent, ExponentSign, ExponentDigits
+  };
+
+  State state = State::Start;
+  bool key = false;
+  NumberPart number = NumberPart::Minus;
+  const char *literal = nullptr;
+  // Characters of the fence, of the literal or of the \u escape read so far.
+  size_t matched = 0;
+  // Where the text kept as it is starts: past a leading code fence.
+  size_t from = 0;
+  // The end of the last value read, before any whitespace after it.
+  size_t valueEnd = 0;
+  // As Validator::resumePosition() and resumeDepth().
+  size_t resumeAt = static_cast<size_t>(-1);
+  size_t depthAt = 0;
+  // As in Validator: how many containers at the bottom of the stack the
+  // resume reads, and whether a string so far had a character the engine
+  // takes for a quote, which keeps the resume point before it.
+  size_t keptAt = 0;
+  bool otherQuotes = false;
+  Stack stack;
+  // How much of the text has been read.
+  size_t i = 0;
+
+  void reset() {
+    Stack kept = std::move(stack);
+    kept.clear();
+    *this = StreamScanner();
+    stack = std::move(kept);
+  }
+
+  // Reads the text from i on.
+  void scan(std::string_view text, int maxDepth) {
+    const char *s = text.data();
+    size_t n = text.length();
+    size_t depthLimit = static_cast<size_t>(maxDepth <= 0 ? 100 : maxDepth);
+    while (i < n && state != State::Invalid) {
+      unsigned char c = static_cast<unsigned char>(s[i]);
+      switch (state) {
+      case State::Start:
+        state = c == '`' ? State::Fence : State::Value;
+        break;
+      case State::Fence:
+        if (matched < 3 ? c == '`'
+                        : matched == 3 ? isFunctionNameCharStart(c)
+                                       : isFunctionNameChar(c)) {
+          matched++;
           i++;
-          continue;
+        } else if (matched < 3) {
+          state = State::Invalid;
+        } else {
+          from = i;
+          state = State::Value;
         }
-        CharT next = text[i + 1];
-        auto it = escapeCharacters.find(next);
-        if (it != escapeCharacters.end()) {
-          str += text.substr(i, 2);
-          i += 2;
-        } else if (next == 'u') {
-          int j = 2;
-          while (j < 6 && i + j < text.length() && isHex(text[i + j])) {
-            j++;
-          }
-          if (j == 6) {
-            str += text.substr(i, 6);
-            i += 6;
-          } else if (i + j >= text.length()) {
-            i = text.length();
-          } else {
-            throw JSONRepairError("Invalid unicode character", i);
-          }
+        break;
+      case State::Value:
+      case State::FirstValue:
+        if (isSpace(c)) {
+          i++;
+        } else if (c == ']' && state == State::FirstValue) {
+          closeEmpty();
         } else {
-          str += next;
-          i += 2;
+          value(c, depthLimit);
         }
-        continue;
-      }
-
-      if (i < text.length()) {
-        CharT c = text[i];
-        if (c == '"' && (i == 0 || text[i - 1] != '\\')) {
-          str += u"\\\"";
+        break;
+      case State::Key:
+      case State::FirstKey:
+        if (isSpace(c)) {
           i++;
-        } else if (isControlCharacter(c)) {
-          auto ctrlIt = controlCharacters.find(c);
-          if (ctrlIt != controlCharacters.end()) {
-            str += ctrlIt->second;
+        } else if (c == '}' && state == State::FirstKey) {
+          closeEmpty();
+        } else if (c == '"') {
+          key = true;
+          state = State::String;
+          i++;
+        } else {
+          state = State::Invalid;
+        }
+        break;
+      case State::Colon:
+        if (isSpace(c)) {
+          i++;
+        } else if (c == ':') {
+          state = State::Value;
+          i++;
+        } else {
+          state = State::Invalid;
+        }
+        break;
+      case State::String:
+        i = skipStringContent<true>(s, i, n);
+        if (i == n)
+          break;
+        if (startsOtherQuote(s[i])) {
+          otherQuotes = otherQuotes || Encoding<char>::doubleQuoteAt(text, i) ||
+                        Encoding<char>::singleQuoteAt(text, i);
+          i++;
+        } else if (s[i] == '"') {
+          i++;
+          if (key) {
+            state = State::Colon;
           } else {
-            str += c;
+            ended();
           }
+        } else if (s[i] == '\\') {
+          state = State::Escape;
           i++;
         } else {
-          if (!isValidStringCharacter(c)) {
-            auto cs = StringT(1, c);
-            std::string rs;
-            utf8::utf16to8(cs.begin(), cs.end(), std::back_inserter(rs));
-            throw JSONRepairError("Invalid character " + rs, i);
-          }
-          str += c;
+          state = State::Invalid;
+        }
+        break;
+      case State::Escape:
+        if (c == 'u') {
+          matched = 0;
+          state = State::Unicode;
+          i++;
+        } else if (isEscapeCharacter(c)) {
+          state = State::String;
+          i++;
+        } else {
+          state = State::Invalid;
+        }
+        break;
+      case State::Unicode:
+        if (!isHex(c)) {
+          state = State::Invalid;
+        } else {
+          i++;
+          if (++matched == 4)
+            state = State::String;
+        }
+        break;
+      case State::Number:
+        numberPart(c);
+        break;
+      case State::Literal:
+        if (c != static_cast<unsigned char>(literal[matched])) {
+          state = State::Invalid;
+        } else {
+          i++;
+          if (literal[++matched] == '\0')
+            ended();
+        }
+        break;
+      case State::After:
+        if (isSpace(c)) {
           i++;
+        } else if (stack.empty()) {
+          state = State::Invalid;
+        } else if (c == ',') {
+          checkpoint(false);
+          state = stack.back() == '{' ? State::Key : State::Value;
+          i++;
+        } else if (c == (stack.back() == '{' ? '}' : ']')) {
+          checkpoint(true);
+          stack.pop_back();
+          i++;
+          valueEnd = i;
+        } else {
+          state = State::Invalid;
         }
+        break;
+      case State::Invalid:
+        break;
       }
+    }
+  }
 
-      // 防止死循环：确保 i 至少推进 1
-      if (i == iBefore) {
-        i++; // 强制推进，避免死循环
-      }
+private:
+  static bool isSpace(unsigned char c) {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+  }
 
-      if (skipEscapeChars) {
-        skipEscapeCharacter();
-      }
+  void checkpoint(bool closing) {
+    if (!otherQuotes) {
+      resumeAt = i;
+      depthAt = stack.size();
+      keptAt = closing ? depthAt - 1 : depthAt;
+    } else if (closing && stack.size() <= keptAt) {
+      resumeAt = static_cast<size_t>(-1);
     }
-  };
+  }
 
-  parseConcatenatedString = [&]() -> bool {
-    bool processed = false;
-    parseWhitespaceAndSkipComments();
-    while (i < text.length() && text[i] == '+') {
-      processed = true;
-      i++;
-      parseWhitespaceAndSkipComments();
-      // 只移除最后一个引号，不移除后续内容
-      output = stripLastOccurrence(output, u"\"", false);
-      size_t start = output.length();
-      bool parsed = parseString(false, static_cast<size_t>(-1));
-      if (parsed) {
-        output = removeAtIndex(output, start,
-                               1); // 移除开头的 "，因为 parseString 会加
-      } else {
-        output = insertBeforeLastWhitespace(output, u"\"");
-      }
-    }
-    return processed;
-  };
+  void ended() {
+    state = State::After;
+    valueEnd = i;
+  }
 
-  parseNumber = [&]() -> bool {
-    size_t start = i;
-    if (i < text.length() && text[i] == '-') {
+  // An empty container ends no value inside it, so leaves no resume point.
+  void closeEmpty() {
+    stack.pop_back();
+    i++;
+    ended();
+  }
+
+  void value(unsigned char c, size_t depthLimit) {
+    switch (c) {
+    case '{':
+    case '[':
+      stack.push_back(static_cast<char>(c));
+      state = stack.size() > depthLimit ? State::Invalid
+              : c == '{'                ? State::FirstKey
+                                        : State::FirstValue;
       i++;
-      if (i >= text.length() || (!isDigit(text[i]) && text[i] != '.')) {
-        output += text.substr(start, i - start) + u"0";
-        return true;
+      return;
+    case '"':
+      key = false;
+      state = State::String;
+      i++;
+      return;
+    case 't':
+    case 'f':
+    case 'n':
+      literal = c == 't' ? "true" : c == 'f' ? "false" : "null";
+      matched = 1;
+      state = State::Literal;
+      i++;
+      return;
+    default:
+      if (c != '-' && !isDigit(c)) {
+        state = State::Invalid;
+        return;
       }
-    }
-
-    while (i < text.length() && isDigit(text[i])) {
+      number = c == '-'   ? NumberPart::Minus
+               : c == '0' ? NumberPart::Zero
+                          : NumberPart::Integer;
+      state = State::Number;
       i++;
     }
+  }
 
-    if (i < text.length() && text[i] == '.') {
-      i++;
-      if (i >= text.length() || !isDigit(text[i])) {
-        output += text.substr(start, i - start) + u"0";
-        return true;
+  void numberPart(unsigned char c) {
+    bool digit = isDigit(c);
+    bool exponent = c == 'e' || c == 'E';
+    switch (number) {
+    case NumberPart::Minus:
+      if (!digit) {
+        state = State::Invalid;
+        return;
       }
-      while (i < text.length() && isDigit(text[i])) {
-        i++;
+      number = c == '0' ? NumberPart::Zero : NumberPart::Integer;
+      break;
+    case NumberPart::Zero:
+    case NumberPart::Integer:
+      if (c == '.') {
+        number = NumberPart::Dot;
+      } else if (exponent) {
+        number = NumberPart::Exponent;
+      } else if (!digit || number == NumberPart::Zero) {
+        ended();
+        return;
       }
-    }
-
-    if (i < text.length() && (text[i] == 'e' || text[i] == 'E')) {
-      i++;
-      if (i < text.length() && (text[i] == '+' || text[i] == '-')) {
-        i++;
+      break;
+    case NumberPart::Dot:
+      if (!digit) {
+        state = State::Invalid;
+        return;
       }
-      if (i >= text.length() || !isDigit(text[i])) {
-        output += text.substr(start, i - start) + u"0";
-        return true;
+      number = NumberPart::Fraction;
+      break;
+    case NumberPart::Fraction:
+      if (exponent) {
+        number = NumberPart::Exponent;
+      } else if (!digit) {
+        ended();
+        return;
       }
-      while (i < text.length() && isDigit(text[i])) {
-        i++;
+      break;
+    case NumberPart::Exponent:
+      if (c == '+' || c == '-') {
+        number = NumberPart::ExponentSign;
+        break;
       }
-    }
-
-    if (i >= text.length() || isDelimiter(text[i]) || isWhitespace(text[i])) {
-      if (i > start) {
-        StringT num = text.substr(start, i - start);
-        bool hasInvalidLeadingZero =
-            num.length() > 1 && num[0] == '0' && num[1] >= '0' && num[1] <= '9';
-        output += hasInvalidLeadingZero ? (u"\"" + num + u"\"") : num;
-        return true;
+      [[fallthrough]];
+    case NumberPart::ExponentSign:
+      if (!digit) {
+        state = State::Invalid;
+        return;
       }
-    } else {
-      i = start;
-      return false;
+      number = NumberPart::ExponentDigits;
+      break;
+    case NumberPart::ExponentDigits:
+      if (!digit) {
+        ended();
+        return;
+      }
+      break;
     }
+    i++;
+  }
+};
 
-    return false;
-  };
+struct JSONRepairStream::State {
+  std::string text;
+  StreamScanner scanner;
+  RepairBuffers<char> buffers;
+  // How much of buffers.output is known to be text[scanner.from...).
+  size_t synced = 0;
+  // Where the engine goes on from once the text stopped being JSON: the
+  // last value start it passed, far enough from the end of the text, that
+  // still stands. The position is npos when there is none.
+  ResumePoint resume;
+  ResumePoints points;
+  // The options the engine ran with last, which the resume point holds for.
+  int maxDepth = 0;
+  bool lenient = false;
 
-  parseKeywords = [&]() -> bool {
-    return parseKeyword(u"true", u"true") || parseKeyword(u"false", u"false") ||
-           parseKeyword(u"null", u"null") || parseKeyword(u"True", u"true") ||
-           parseKeyword(u"False", u"false") || parseKeyword(u"None", u"null");
-  };
+  // Makes buffers.output the text from scanner.from to `end`.
+  void keep(size_t end) {
+    std::string &output = buffers.output;
+    size_t length = end - scanner.from;
+    size_t same = std::min({synced, length, output.length()});
+    output.resize(same);
+    output.append(text, scanner.from + same, length - same);
+    synced = length;
+  }
 
-  parseKeyword = [&](const StringT &name, const StringT &value) -> bool {
-    if (i + name.length() <= text.length() &&
-        text.substr(i, name.length()) == name) {
-      output += value;
-      i += name.length();
-      return true;
+  // Closes the open containers, innermost first.
+  void close() {
+    const StreamScanner::Stack &stack = scanner.stack;
+    for (size_t k = stack.size(); k > 0; k--) {
+      buffers.output += stack[k - 1] == '{' ? '}' : ']';
     }
-    return false;
-  };
+  }
 
-  parseUnquotedString = [&](bool isKey) -> bool {
-    size_t start = i;
-    if (i < text.length() && isFunctionNameCharStart(text[i])) {
-      while (i < text.length() && isFunctionNameChar(text[i])) {
-        i++;
-      }
-      size_t j = i;
-      while (j < text.length() && isWhitespace(text[j])) {
-        j++;
-      }
-      if (j < text.length() && text[j] == '(') {
-        i = j + 1;
-        parseValue();
-        if (i < text.length() && text[i] == ')') {
-          i++;
-          if (i < text.length() && text[i] == ';') {
-            i++;
-          }
-        }
-        return true;
-      }
+  // The last bytes of `text` when they start a UTF-8 character and the
+  // piece ended before the rest of it.
+  static size_t partialCharacter(std::string_view text) {
+    size_t n = text.length();
+    for (size_t k = 1; k <= std::min(n, size_t(3)); k++) {
+      unsigned char c = static_cast<unsigned char>(text[n - k]);
+      if ((c & 0xC0) == 0x80)
+        continue;
+      size_t length = c >= 0xF8   ? 1
+                      : c >= 0xF0 ? 4
+                      : c >= 0xE0 ? 3
+                      : c >= 0xC0 ? 2
+                                  : 1;
+      return length > k ? k : 0;
     }
+    return 0;
+  }
 
-    while (i < text.length() && !isUnquotedStringDelimiter(text[i]) &&
-           !isQuote(text[i]) && (!isKey || text[i] != ':')) {
-      i++;
+  JSONRepairStatus repair(const JSONRepairOptions &options) {
+    using ScanState = StreamScanner::State;
+    // A character cut off at the end waits for the rest of it, so that the
+    // snapshot is never cut inside one.
+    std::string_view complete(text.data(),
+                              text.length() - partialCharacter(text));
+    if (!fitsInput(options, complete.length())) {
+      buffers.output.clear();
+      synced = 0;
+      return failure(JSONRepairErrorCode::InputSizeLimit, 0);
     }
+    scanner.scan(complete, options.maxDepth);
 
-    if (i > start && i > 0 && text[i - 1] == ':' && i + 2 <= text.length()) {
-      StringT test =
-          text.substr(start, std::min(i + 2 - start, text.length() - start));
-      if (isUrlStart(test)) {
-        while (i < text.length() && isUrlChar(text[i])) {
-          i++;
-        }
-      }
+    // Valid JSON so far: keep it and close what is open.
+    if (scanner.state == ScanState::String && !scanner.key) {
+      resume.position = std::string::npos;
+      keep(complete.length());
+      buffers.output += '"';
+      close();
+      return {};
     }
-
-    if (i > start) {
-      while (i > start && isWhitespace(text[i - 1])) {
-        i--;
-      }
-      StringT symbol = text.substr(start, i - start);
-      if (symbol == u"undefined") {
-        output += u"null";
-      } else {
-        StringT escaped = u"\"";
-        for (CharT c : symbol) {
-          if (c == '"' || c == '\\') {
-            escaped += '\\';
-          }
-          escaped += c;
-        }
-        escaped += '"';
-        output += escaped;
-      }
-      if (i < text.length() && text[i] == '"') {
-        i++;
-      }
-      return true;
+    if (scanner.state == ScanState::After) {
+      resume.position = std::string::npos;
+      keep(scanner.valueEnd);
+      close();
+      buffers.output.append(complete.substr(scanner.valueEnd));
+      return {};
     }
-    return false;
-  };
 
-  parseRegex = [&]() -> bool {
-    if (i < text.length() && text[i] == '/') {
-      size_t start = i;
-      i++;
-      while (i < text.length() &&
-             (text[i] != '/' || (i > 0 && text[i - 1] == '\\'))) {
-        i++;
-      }
-      if (i < text.length()) {
-        i++; // skip closing '/'
-      }
-      output += u"\"" + text.substr(start, i - start) + u"\"";
-      return true;
+    // Otherwise the engine takes over where it stopped the last time, or
+    // where the last value ended.
+    if (options.maxDepth != maxDepth || options.lenient != lenient) {
+      resume.position = std::string::npos;
+      maxDepth = options.maxDepth;
+      lenient = options.lenient;
     }
-    return false;
-  };
+    bool resumed = resume.position != std::string::npos &&
+                   (scanner.resumeAt == std::string::npos ||
+                    resume.position > scanner.resumeAt);
+    if (resumed) {
+      synced = std::min(synced, resume.length);
+      buffers.output.resize(resume.length);
+    } else if (scanner.resumeAt != std::string::npos) {
+      keep(scanner.resumeAt);
+    } else {
+      synced = 0;
+      buffers.output.clear();
+    }
+    Parser<char, std::allocator<char>, ResumedOutput<char>> parser(
+        complete, options, buffers);
+    ResumedOutput<char> &output = parser.written();
+    output.keep(points);
+    JSONRepairStatus status =
+        resumed ? parser.parseFrom(resume)
+        : scanner.resumeAt != std::string::npos
+            ? parser.parseFrom(scanner.resumeAt, scanner.stack,
+                               scanner.depthAt)
+            : parser.parse();
+    synced = std::min(synced, output.edited());
+    if (ResumePoint *point = output.lastStanding()) {
+      std::swap(resume, *point);
+    } else if (!resumed || output.edited() < resume.length) {
+      resume.position = std::string::npos;
+    }
+    return status;
+  }
+};
 
-  // --- Main logic ---
+JSONRepairStream::JSONRepairStream(const JSONRepairOptions &options)
+    : options(options), state(new State) {}
 
-  parseMarkdownCodeBlock({u"```", u"[```", u"{```"});
+JSONRepairStream::~JSONRepairStream() = default;
+JSONRepairStream::JSONRepairStream(JSONRepairStream &&) noexcept = default;
+JSONRepairStream &
+JSONRepairStream::operator=(JSONRepairStream &&) noexcept = default;
 
-  bool processed = parseValue();
-  if (!processed) {
-    throw JSONRepairError("Unexpected end of json string", text.length());
-  }
+void JSONRepairStream::append(const char *data, size_t length) {
+  state->text.append(data, length);
+}
 
-  parseMarkdownCodeBlock({u"```", u"```]", u"```}"});
+void JSONRepairStream::append(std::string_view chunk) {
+  state->text.append(chunk);
+}
 
-  bool processedComma = parseCharacter(',');
-  if (processedComma) {
-    parseWhitespaceAndSkipComments();
-  }
+const std::string &JSONRepairStream::text() const { return state->text; }
 
-  if (i < text.length() && isStartOfValue(text[i]) &&
-      endsWithCommaOrNewline(output)) {
-    if (!processedComma) {
-      output = insertBeforeLastWhitespace(output, u",");
-    }
-    parseNewlineDelimitedJSON();
-  } else if (processedComma) {
-    output = stripLastOccurrence(output, u",");
-  }
+const std::string &JSONRepairStream::snapshot() {
+  if (JSONRepairStatus status = snapshot(std::nothrow); !status)
+    raise<char>(status, state->text);
+  return state->buffers.output;
+}
 
-  while (i < text.length() && (text[i] == '}' || text[i] == ']')) {
-    i++;
-    parseWhitespaceAndSkipComments();
+JSONRepairStatus JSONRepairStream::snapshot(const std::nothrow_t &) {
+  JSONRepairStatus status = state->repair(options);
+  if (!status) {
+    state->buffers.output.clear();
+    state->synced = 0;
+    state->resume.position = std::string::npos;
   }
+  return status;
+}
 
-  if (i >= text.length()) {
-    return output;
-  }
+const std::string &JSONRepairStream::output() const {
+  return state->buffers.output;
+}
 
-  auto cs = StringT(1, text[i]);
-  std::string rs;
-  utf8::utf16to8(cs.begin(), cs.end(), std::back_inserter(rs));
-  throw JSONRepairError("Unexpected character " + rs, i);
+void JSONRepairStream::clear() {
+  state->text.clear();
+  state->scanner.reset();
+  state->buffers.output.clear();
+  state->synced = 0;
+  state->resume.position = std::string::npos;
 }
@@ -3,8 +3,20 @@
 //
 #ifndef JSONREPAIR_HPP_
 #define JSONREPAIR_HPP_
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <memory>
+#include <new>
 #include <string>
+#include <string_view>
 #include <stdexcept>
+#include <vector>
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#endif
 
 
 class JSONRepairError : public std::runtime_error {
@@ -13,7 +25,552 @@ public:
     JSONRepairError(const std::string& message, size_t pos);
 };
 
-std::string jsonrepair(const std::string& text, int maxDepth = 100) ;
-std::u16string jsonrepair(const std::u16string& text, int maxDepth = 100);
+// Thrown instead of a plain JSONRepairError when a repair runs out of one of
+// its JSONRepairOptions budgets or is cancelled; `position` is where the
+// parser was when it gave up.
+class JSONRepairLimitError : public JSONRepairError {
+public:
+    enum class Limit { InputSize, OutputSize, Steps, Deadline, Cancelled };
+    Limit limit;
+    JSONRepairLimitError(const std::string& message, size_t pos, Limit limit);
+};
+
+// Stops the repairs that were given this token. cancel() may be called from
+// any thread; a running repair notices it within a few thousand steps.
+class JSONRepairCancellation {
+public:
+    void cancel() noexcept { flag.store(true, std::memory_order_relaxed); }
+    bool cancelled() const noexcept { return flag.load(std::memory_order_relaxed); }
+private:
+    std::atomic<bool> flag{false};
+};
+
+// Why a repair failed. The throwing API reports the same errors as
+// JSONRepairError, or JSONRepairLimitError for the budget ones.
+enum class JSONRepairErrorCode {
+    None,
+    UnexpectedEnd,           // "Unexpected end of json string"
+    UnexpectedCharacter,     // "Unexpected character"
+    MaximumDepthExceeded,    // "Maximum depth exceeded"
+    ObjectKeyExpected,       // "Object key expected"
+    ColonExpected,           // "Colon expected"
+    InvalidUnicodeCharacter, // "Invalid unicode character"
+    InvalidCharacter,        // "Invalid character"
+    InputSizeLimit,
+    OutputSizeLimit,
+    StepLimit,
+    Deadline,
+    Cancelled,
+    WriteFailed,             // a JSONRepairSink refused the output
+    DocumentSequence,        // a second document once a JSONRepairSink has
+                             // part of the first
+};
+
+// How a repair that does not throw ended. `message` is a static string,
+// empty on success; `position` is where the error was found.
+struct JSONRepairStatus {
+    JSONRepairErrorCode error = JSONRepairErrorCode::None;
+    size_t position = 0;
+    const char* message = "";
+    explicit operator bool() const { return error == JSONRepairErrorCode::None; }
+};
+
+// Text a lenient repair could not make sense of. It was left out of the
+// output, or written as a quoted key when a colon followed it. `length` is
+// zero for something missing, such as the colon after a key.
+struct JSONRepairSpan {
+    JSONRepairErrorCode error;
+    size_t position;
+    size_t length;
+};
+
+// The repaired document, empty when the repair failed. A lenient repair
+// also lists what it left out, in text order.
+template <typename StringT>
+struct JSONRepairResult : JSONRepairStatus {
+    StringT output;
+    std::vector<JSONRepairSpan> unrecoverable;
+};
+
+// Limits for one repair call. Zero means unlimited for every budget.
+struct JSONRepairOptions {
+    int maxDepth = 100;
+    // Largest input accepted, in code units.
+    size_t maxInputSize = 0;
+    // Largest output allowed, as a multiple of the input length. Short inputs
+    // may always grow to 64 code units, enough to close what they opened.
+    double maxOutputRatio = 0;
+    // Parser loop iterations allowed, about one per value, counted as well
+    // by the check for valid JSON that comes first; the work of a repair is
+    // linear in them.
+    uint64_t maxSteps = 0;
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::time_point::max();
+    const JSONRepairCancellation* cancellation = nullptr;
+    // Keeps going past a missing object key or colon and past text after
+    // the document, instead of failing on the first of them; see
+    // JSONRepairSpan. The other errors still end the repair.
+    bool lenient = false;
+};
+
+// Repairs UTF-8 text in place of its bytes, without transcoding; error
+// positions are byte offsets. Text that is valid JSON already is returned
+// unchanged without running the repair engine. Every entry point reads the
+// text through a view, so a std::string, a string_view of a larger buffer
+// or a string literal is repaired where it is.
+std::string jsonrepair(std::string_view text, int maxDepth = 100) ;
+// Repairs UTF-16 text; error positions are code unit offsets.
+std::u16string jsonrepair(std::u16string_view text, int maxDepth = 100);
+// Repairs UTF-32 text; error positions are code point offsets.
+std::u32string jsonrepair(std::u32string_view text, int maxDepth = 100);
+
+// Same as above under the budgets in `options`; throws JSONRepairLimitError
+// when one of them runs out.
+std::string jsonrepair(std::string_view text, const JSONRepairOptions& options);
+std::u16string jsonrepair(std::u16string_view text, const JSONRepairOptions& options);
+std::u32string jsonrepair(std::u32string_view text, const JSONRepairOptions& options);
+
+// The same for a NUL-terminated string, which would otherwise convert to
+// both a view and a string. Text with a length, such as a network frame or
+// a mapped file, goes in as a string_view.
+std::string jsonrepair(const char* text, int maxDepth = 100);
+std::string jsonrepair(const char* text, const JSONRepairOptions& options);
+std::u16string jsonrepair(const char16_t* text, int maxDepth = 100);
+std::u16string jsonrepair(const char16_t* text, const JSONRepairOptions& options);
+std::u32string jsonrepair(const char32_t* text, int maxDepth = 100);
+std::u32string jsonrepair(const char32_t* text, const JSONRepairOptions& options);
+
+// Repairs text only when it is not valid JSON. Returns false, leaving
+// `repaired` untouched, when `text` can be used as it is; otherwise stores
+// the repaired document in `repaired` and returns true.
+bool jsonrepair(std::string_view text, std::string& repaired, int maxDepth = 100);
+bool jsonrepair(std::u16string_view text, std::u16string& repaired, int maxDepth = 100);
+bool jsonrepair(std::u32string_view text, std::u32string& repaired, int maxDepth = 100);
+bool jsonrepair(std::string_view text, std::string& repaired, const JSONRepairOptions& options);
+bool jsonrepair(std::u16string_view text, std::u16string& repaired, const JSONRepairOptions& options);
+bool jsonrepair(std::u32string_view text, std::u32string& repaired, const JSONRepairOptions& options);
+
+// Repairs text handed over to it in its own storage, which the result takes
+// over: the repair is worked out as edits (see jsonedits) and made in place,
+// so a large document is not held twice. Throws as the overloads above, with
+// `text` unchanged.
+std::string jsonrepair(std::string&& text, int maxDepth = 100);
+std::string jsonrepair(std::string&& text, const JSONRepairOptions& options);
+std::u16string jsonrepair(std::u16string&& text, int maxDepth = 100);
+std::u16string jsonrepair(std::u16string&& text, const JSONRepairOptions& options);
+std::u32string jsonrepair(std::u32string&& text, int maxDepth = 100);
+std::u32string jsonrepair(std::u32string&& text, const JSONRepairOptions& options);
+
+// Repairs without throwing, for callers that see many unrepairable inputs or
+// build with exceptions disabled; there, the throwing overloads abort on
+// error instead. The throwing overloads are wrappers over these.
+JSONRepairResult<std::string> jsonrepair(std::string_view text, const std::nothrow_t&,
+                                         const JSONRepairOptions& options = {});
+JSONRepairResult<std::u16string> jsonrepair(std::u16string_view text, const std::nothrow_t&,
+                                            const JSONRepairOptions& options = {});
+JSONRepairResult<std::u32string> jsonrepair(std::u32string_view text, const std::nothrow_t&,
+                                            const JSONRepairOptions& options = {});
+
+// The kinds of repair a document needs, as reported by jsonanalyze.
+enum class JSONRepairCategory {
+    Comment,          // a comment removed
+    Whitespace,       // a non-ASCII space replaced
+    CodeFence,        // a markdown code fence removed
+    Quote,            // a single, curly or backtick quote replaced
+    UnquotedString,   // an unquoted key or string, or a regex, quoted
+    StringEscape,     // a quote, control character or backslash escaped
+    MissingQuote,     // a closing quote added
+    MissingComma,     // a comma added between values
+    MissingColon,     // a colon added after a key
+    MissingValue,     // null added after a key
+    RedundantComma,   // a leading or trailing comma removed
+    MissingBracket,   // a closing brace or bracket added
+    RedundantBracket, // a closing brace or bracket after the document removed
+    Ellipsis,         // "..." removed
+    Keyword,          // True, False, None or undefined replaced
+    Number,           // a truncated number completed, or leading zeros quoted
+    FunctionCall,     // a JSONP or MongoDB style call unwrapped
+    Concatenation,    // strings joined with + merged
+    NewlineDelimited, // a sequence of documents wrapped in an array
+};
+constexpr size_t JSONRepairCategoryCount = 19;
+
+// What a repair would do, without the repaired document. A category's
+// position is where in the text it was first needed; the positions of the
+// categories not needed are meaningless. Valid JSON needs no repair.
+struct JSONRepairAnalysis : JSONRepairStatus {
+    uint32_t categories = 0;
+    size_t positions[JSONRepairCategoryCount] = {};
+    bool needsRepair() const { return categories != 0; }
+    bool needs(JSONRepairCategory category) const {
+        return (categories >> static_cast<unsigned>(category)) & 1;
+    }
+    size_t firstPosition(JSONRepairCategory category) const {
+        return positions[static_cast<size_t>(category)];
+    }
+};
+
+// Runs the repair engine without building the output, for the callers that
+// only need to know whether, and how, a document is broken. Errors are
+// reported as by the std::nothrow overloads; the categories found before an
+// error are kept.
+JSONRepairAnalysis jsonanalyze(std::string_view text, const JSONRepairOptions& options = {});
+JSONRepairAnalysis jsonanalyze(std::u16string_view text, const JSONRepairOptions& options = {});
+JSONRepairAnalysis jsonanalyze(std::u32string_view text, const JSONRepairOptions& options = {});
+
+// A repair as a cut and an append: the repaired document is the first `keep`
+// code units of the text followed by `suffix`. For a truncated document that
+// is most of the text and the few quotes and brackets that close it, so a
+// writer can send the text and the suffix as they are. Valid JSON is kept
+// whole with an empty suffix; when the repair edits the text further in,
+// `keep` can be zero and `suffix` the whole repaired document.
+template <typename StringT>
+struct JSONRepairCompletion : JSONRepairStatus {
+    size_t keep = 0;
+    StringT suffix;
+};
+
+// Repairs `text` into a JSONRepairCompletion, without copying the part of it
+// that is kept. Errors are reported as by the std::nothrow overloads.
+JSONRepairCompletion<std::string> jsoncomplete(std::string_view text,
+                                               const JSONRepairOptions& options = {});
+JSONRepairCompletion<std::u16string> jsoncomplete(std::u16string_view text,
+                                                  const JSONRepairOptions& options = {});
+JSONRepairCompletion<std::u32string> jsoncomplete(std::u32string_view text,
+                                                  const JSONRepairOptions& options = {});
+
+// One change of a repair: the `length` code units of the text at `offset`
+// are replaced with `text`. Either may be empty.
+template <typename StringT>
+struct JSONRepairEdit {
+    size_t offset;
+    size_t length;
+    StringT text;
+};
+
+// A repair as the edits that make the text the repaired document, in text
+// order and without overlap; offsets refer to the text as given. Valid JSON
+// needs none.
+template <typename StringT>
+struct JSONRepairEdits : JSONRepairStatus {
+    std::vector<JSONRepairEdit<StringT>> edits;
+};
+
+// Repairs `text` into a JSONRepairEdits. The repaired document is never
+// built, so a large text with few repairs costs little more than its edits.
+// Errors are reported as by the std::nothrow overloads.
+JSONRepairEdits<std::string> jsonedits(std::string_view text,
+                                       const JSONRepairOptions& options = {});
+JSONRepairEdits<std::u16string> jsonedits(std::u16string_view text,
+                                          const JSONRepairOptions& options = {});
+JSONRepairEdits<std::u32string> jsonedits(std::u32string_view text,
+                                          const JSONRepairOptions& options = {});
+
+// Where a repair writes the document as it is produced, for a caller that
+// passes it on instead of holding it, such as a proxy. write() is given the
+// output in order, a part at a time, each once the repair can no longer
+// change it; returning false stops the repair with WriteFailed. A sequence
+// of documents, which jsonrepair wraps in an array, fails with
+// DocumentSequence once the sink has part of the first.
+template <typename CharT>
+class JSONRepairSink {
+public:
+    virtual ~JSONRepairSink() = default;
+    virtual bool write(const CharT* data, size_t length) = 0;
+};
+
+// Hands each part to a function.
+template <typename CharT>
+class JSONRepairFunctionSink : public JSONRepairSink<CharT> {
+public:
+    using Function = std::function<bool(std::basic_string_view<CharT>)>;
+    explicit JSONRepairFunctionSink(Function function) : function(std::move(function)) {}
+    bool write(const CharT* data, size_t length) override { return function({data, length}); }
+private:
+    Function function;
+};
+
+// Copies the output to the `capacity` code units at `data`. A part that does
+// not fit fails the write; size() is how much was written before it.
+template <typename CharT>
+class JSONRepairBufferSink : public JSONRepairSink<CharT> {
+public:
+    JSONRepairBufferSink(CharT* data, size_t capacity) : data(data), capacity(capacity) {}
+    bool write(const CharT* part, size_t length) override {
+        if (length > capacity - used)
+            return false;
+        std::char_traits<CharT>::copy(data + used, part, length);
+        used += length;
+        return true;
+    }
+    size_t size() const { return used; }
+private:
+    CharT* data;
+    size_t capacity;
+    size_t used = 0;
+};
+
+// Writes to a std::ostream, failing once the stream has.
+class JSONRepairOstreamSink : public JSONRepairSink<char> {
+public:
+    explicit JSONRepairOstreamSink(std::ostream& out) : out(out) {}
+    bool write(const char* data, size_t length) override;
+private:
+    std::ostream& out;
+};
+
+#if __has_include(<unistd.h>)
+// Writes to a POSIX file descriptor, such as a socket or a pipe, until all
+// of each part is written or write(2) fails.
+class JSONRepairFdSink : public JSONRepairSink<char> {
+public:
+    explicit JSONRepairFdSink(int fd) : fd(fd) {}
+    bool write(const char* data, size_t length) override;
+private:
+    int fd;
+};
+#endif
+
+// Repairs `text` into `sink`. Only the end of the output that the repair may
+// still edit is held back, in a buffer of a few kilobytes that grows only
+// for a long string, so memory does not grow with the document and the
+// first part is written long before the repair ends. Text that is valid
+// JSON is written as it is, in one part. Several documents in a row are
+// wrapped in an array only while none of the first has been written; after
+// that the next one is text after the document, which fails, or which a
+// lenient repair skips. On error the sink has been given part of the
+// document.
+JSONRepairStatus jsonrepair(std::string_view text, JSONRepairSink<char>& sink,
+                            const JSONRepairOptions& options = {});
+JSONRepairStatus jsonrepair(std::u16string_view text, JSONRepairSink<char16_t>& sink,
+                            const JSONRepairOptions& options = {});
+JSONRepairStatus jsonrepair(std::u32string_view text, JSONRepairSink<char32_t>& sink,
+                            const JSONRepairOptions& options = {});
+
+// Repairs one document after another, keeping its working memory between
+// calls. Once that has grown to fit the largest document seen, a repair
+// allocates nothing but the growth of `out`. Not thread safe: use one per
+// thread.
+class JSONRepairer {
+public:
+    explicit JSONRepairer(const JSONRepairOptions& options = {});
+    ~JSONRepairer();
+    JSONRepairer(JSONRepairer&&) noexcept;
+    JSONRepairer& operator=(JSONRepairer&&) noexcept;
+
+    // Appends the repaired `text` to `out`, or `text` itself when it is valid
+    // JSON. Throws like jsonrepair, leaving `out` as it was.
+    void repair(std::string_view text, std::string& out);
+    void repair(std::u16string_view text, std::u16string& out);
+    void repair(std::u32string_view text, std::u32string& out);
+
+    // Same without throwing; `out` is left as it was on error.
+    JSONRepairStatus repair(std::string_view text, std::string& out, const std::nothrow_t&);
+    JSONRepairStatus repair(std::u16string_view text, std::u16string& out, const std::nothrow_t&);
+    JSONRepairStatus repair(std::u32string_view text, std::u32string& out, const std::nothrow_t&);
+#if defined(__cpp_char8_t)
+    void repair(std::u8string_view text, std::u8string& out);
+    JSONRepairStatus repair(std::u8string_view text, std::u8string& out, const std::nothrow_t&);
+#endif
+
+    // Applies to every later repair. A deadline is a point in time, so it
+    // needs setting again for each.
+    JSONRepairOptions options;
+
+private:
+    struct Buffers;
+    std::unique_ptr<Buffers> buffers;
+
+    // For the char8_t overloads: repairs UTF-8 `text` in the char buffers,
+    // which hold the result until the next repair, and views it, or `text`
+    // itself when it is valid.
+    std::string_view repairBytes(std::string_view text);
+    JSONRepairStatus repairBytes(std::string_view text, std::string_view& repaired,
+                                 const std::nothrow_t&);
+};
+
+// Repairs UTF-8 text that arrives in pieces, such as the tokens of a model
+// response, so that a preview of the document can be taken at any moment.
+// Text that is valid JSON so far is kept as it is and closed from the
+// containers left open, and the stream remembers how far it has read it, so
+// a snapshot costs time in proportion to the text appended since the last
+// one. Past a point where the text stops being JSON the engine repairs it,
+// and the next snapshot goes on from a value the engine started a little
+// before the end of the text so far, in a container of the document or of a
+// later one in a sequence, so the cost still follows the text appended. A
+// value the engine is still reading at the end of the text has no such
+// start inside it: a string, a chain of strings joined with +, or a block
+// comment left open there is read again from its start by every snapshot,
+// at a cost that follows its length. Not thread safe.
+class JSONRepairStream {
+public:
+    explicit JSONRepairStream(const JSONRepairOptions& options = {});
+    ~JSONRepairStream();
+    JSONRepairStream(JSONRepairStream&&) noexcept;
+    JSONRepairStream& operator=(JSONRepairStream&&) noexcept;
+
+    void append(std::string_view chunk);
+    void append(const char* data, size_t length);
+    // Everything appended since construction or clear().
+    const std::string& text() const;
+
+    // The repair of text(), with two differences from jsonrepair(text()).
+    // A UTF-8 character cut off at the end is left out until the rest of it
+    // arrives. And text that is valid JSON so far is kept as it is, with
+    // the string open at its end closed and then its open containers, where
+    // jsonrepair may take a quote character or a delimiter in a string for
+    // its end, or reject the text. Throws like jsonrepair. The string is the
+    // stream's own and changes with the next snapshot.
+    const std::string& snapshot();
+    // Same without throwing; output() then holds the repair, or nothing on
+    // error.
+    JSONRepairStatus snapshot(const std::nothrow_t&);
+    const std::string& output() const;
+
+    // Starts on a new document, keeping the memory of this one.
+    void clear();
+
+    // Applies to every later snapshot.
+    JSONRepairOptions options;
+
+private:
+    struct State;
+    std::unique_ptr<State> state;
+};
+
+#if defined(__cpp_lib_memory_resource)
+// Repairs with every allocation, the result included, made from `resource`.
+// Under a per-request std::pmr::monotonic_buffer_resource nothing touches the
+// global heap, and all of it is released at once with the resource.
+std::pmr::string jsonrepair(std::string_view text, std::pmr::memory_resource* resource,
+                            const JSONRepairOptions& options = {});
+std::pmr::u16string jsonrepair(std::u16string_view text, std::pmr::memory_resource* resource,
+                               const JSONRepairOptions& options = {});
+std::pmr::u32string jsonrepair(std::u32string_view text, std::pmr::memory_resource* resource,
+                               const JSONRepairOptions& options = {});
+#endif
+
+#if defined(__cpp_char8_t)
+// The char8_t overloads, for a C++20 caller. The library itself may be built
+// as C++17, which has no char8_t, so these are defined here on top of the
+// char ones: the text is read in place as the same UTF-8 bytes, and the
+// result is copied once into the char8_t string. jsonrepair(std::u8string&&)
+// repairs a view of the text rather than in its storage.
+namespace jsonrepair_u8 {
+inline std::string_view bytes(std::u8string_view text) {
+    return {reinterpret_cast<const char*>(text.data()), text.size()};
+}
+inline std::u8string_view units(std::string_view text) {
+    return {reinterpret_cast<const char8_t*>(text.data()), text.size()};
+}
+} // namespace jsonrepair_u8
+
+inline std::u8string jsonrepair(std::u8string_view text, int maxDepth = 100) {
+    return std::u8string(jsonrepair_u8::units(jsonrepair(jsonrepair_u8::bytes(text), maxDepth)));
+}
+inline std::u8string jsonrepair(std::u8string_view text, const JSONRepairOptions& options) {
+    return std::u8string(jsonrepair_u8::units(jsonrepair(jsonrepair_u8::bytes(text), options)));
+}
+inline std::u8string jsonrepair(const char8_t* text, int maxDepth = 100) {
+    return jsonrepair(std::u8string_view(text), maxDepth);
+}
+inline std::u8string jsonrepair(const char8_t* text, const JSONRepairOptions& options) {
+    return jsonrepair(std::u8string_view(text), options);
+}
+inline std::u8string jsonrepair(std::u8string&& text, int maxDepth = 100) {
+    return jsonrepair(std::u8string_view(text), maxDepth);
+}
+inline std::u8string jsonrepair(std::u8string&& text, const JSONRepairOptions& options) {
+    return jsonrepair(std::u8string_view(text), options);
+}
+
+inline bool jsonrepair(std::u8string_view text, std::u8string& repaired,
+                       const JSONRepairOptions& options) {
+    std::string out;
+    if (!jsonrepair(jsonrepair_u8::bytes(text), out, options))
+        return false;
+    repaired = jsonrepair_u8::units(out);
+    return true;
+}
+inline bool jsonrepair(std::u8string_view text, std::u8string& repaired, int maxDepth = 100) {
+    JSONRepairOptions options;
+    options.maxDepth = maxDepth;
+    return jsonrepair(text, repaired, options);
+}
+
+inline JSONRepairResult<std::u8string> jsonrepair(std::u8string_view text, const std::nothrow_t&,
+                                                  const JSONRepairOptions& options = {}) {
+    JSONRepairResult<std::string> result =
+        jsonrepair(jsonrepair_u8::bytes(text), std::nothrow, options);
+    JSONRepairResult<std::u8string> u8;
+    static_cast<JSONRepairStatus&>(u8) = result;
+    u8.output = jsonrepair_u8::units(result.output);
+    u8.unrecoverable = std::move(result.unrecoverable);
+    return u8;
+}
+
+inline JSONRepairAnalysis jsonanalyze(std::u8string_view text,
+                                      const JSONRepairOptions& options = {}) {
+    return jsonanalyze(jsonrepair_u8::bytes(text), options);
+}
+
+inline JSONRepairCompletion<std::u8string> jsoncomplete(std::u8string_view text,
+                                                        const JSONRepairOptions& options = {}) {
+    JSONRepairCompletion<std::string> completion =
+        jsoncomplete(jsonrepair_u8::bytes(text), options);
+    JSONRepairCompletion<std::u8string> u8;
+    static_cast<JSONRepairStatus&>(u8) = completion;
+    u8.keep = completion.keep;
+    u8.suffix = jsonrepair_u8::units(completion.suffix);
+    return u8;
+}
+
+inline JSONRepairEdits<std::u8string> jsonedits(std::u8string_view text,
+                                                const JSONRepairOptions& options = {}) {
+    JSONRepairEdits<std::string> edits = jsonedits(jsonrepair_u8::bytes(text), options);
+    JSONRepairEdits<std::u8string> u8;
+    static_cast<JSONRepairStatus&>(u8) = edits;
+    u8.edits.reserve(edits.edits.size());
+    for (const JSONRepairEdit<std::string>& edit : edits.edits)
+        u8.edits.push_back(
+            {edit.offset, edit.length, std::u8string(jsonrepair_u8::units(edit.text))});
+    return u8;
+}
+
+// The sink is given the parts as they are written, without a copy.
+inline JSONRepairStatus jsonrepair(std::u8string_view text, JSONRepairSink<char8_t>& sink,
+                                   const JSONRepairOptions& options = {}) {
+    struct Bytes : JSONRepairSink<char> {
+        explicit Bytes(JSONRepairSink<char8_t>& sink) : sink(sink) {}
+        bool write(const char* data, size_t length) override {
+            return sink.write(reinterpret_cast<const char8_t*>(data), length);
+        }
+        JSONRepairSink<char8_t>& sink;
+    } bytes(sink);
+    return jsonrepair(jsonrepair_u8::bytes(text), bytes, options);
+}
+
+// The repair is appended from the repairer's own buffers, without a copy.
+inline void JSONRepairer::repair(std::u8string_view text, std::u8string& out) {
+    out += jsonrepair_u8::units(repairBytes(jsonrepair_u8::bytes(text)));
+}
+inline JSONRepairStatus JSONRepairer::repair(std::u8string_view text, std::u8string& out,
+                                             const std::nothrow_t&) {
+    std::string_view repaired;
+    JSONRepairStatus status = repairBytes(jsonrepair_u8::bytes(text), repaired, std::nothrow);
+    if (status)
+        out += jsonrepair_u8::units(repaired);
+    return status;
+}
+
+#if defined(__cpp_lib_memory_resource)
+inline std::pmr::u8string jsonrepair(std::u8string_view text,
+                                     std::pmr::memory_resource* resource,
+                                     const JSONRepairOptions& options = {}) {
+    std::pmr::string repaired = jsonrepair(jsonrepair_u8::bytes(text), resource, options);
+    return std::pmr::u8string(jsonrepair_u8::units(repaired), resource);
+}
+#endif
+#endif
 
-#endif
\ No newline at end of file
+#endif
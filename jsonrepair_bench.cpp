@@ -0,0 +1,394 @@
+#include "jsonrepair/jsonrepair.hpp"
+#include "jsonrepair/utf8.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Usage: jsonrepair_bench [benchmark ...]
+// Runs every benchmark when no name is given.
+
+static double secondsPerCall(const std::function<void()> &fn) {
+  using Clock = std::chrono::steady_clock;
+  fn(); // warm up
+  size_t calls = 0;
+  auto start = Clock::now();
+  std::chrono::duration<double> elapsed{};
+  do {
+    fn();
+    calls++;
+    elapsed = Clock::now() - start;
+  } while (elapsed.count() < 0.5);
+  return elapsed.count() / static_cast<double>(calls);
+}
+
+static void reportThroughput(const char *label, size_t bytes, double seconds) {
+  std::printf("  %-34s %9.1f MB/s\n", label,
+              static_cast<double>(bytes) / seconds / (1024.0 * 1024.0));
+}
+
+// An LLM style tool call payload of roughly `bytes` bytes: an array of
+// records with natural language (partly CJK) strings, Python constants and
+// no closing bracket.
+static std::string llmPayload(size_t bytes) {
+  static const char *const sentences[] = {
+      "The quick brown fox jumps over the lazy dog. ",
+      "表 5. HR 和 RR 的完成时间及吞吐量提升 ",
+      "Summary: throughput increased by 12% after the change. ",
+      "Translation done with 😀 confidence. ",
+  };
+  std::string text = "[\n";
+  for (size_t n = 0; text.size() < bytes; n++) {
+    text += "  {\"id\": " + std::to_string(n) + ", \"role\": \"assistant\",\n";
+    text += "   \"content\": \"";
+    for (size_t k = 0; k < 8; k++)
+      text += sentences[(n + k) % 4];
+    text += "\", \"done\": True},\n";
+  }
+  return text;
+}
+
+static void benchUtf8Throughput() {
+  std::printf("utf8: MB-sized LLM payload\n");
+  for (size_t size : {size_t(1) << 20, size_t(8) << 20}) {
+    std::string text = llmPayload(size);
+    std::printf(" %zu KiB\n", text.size() / 1024);
+    reportThroughput("jsonrepair(std::string)", text.size(),
+                     secondsPerCall([&] { jsonrepair(text); }));
+    reportThroughput("UTF-16 round trip", text.size(), secondsPerCall([&] {
+                       std::u16string input;
+                       utf8::utf8to16(text.begin(), text.end(),
+                                      std::back_inserter(input));
+                       std::u16string output = jsonrepair(input);
+                       std::string result;
+                       utf8::utf16to8(output.begin(), output.end(),
+                                      std::back_inserter(result));
+                     }));
+  }
+}
+
+// Small documents (< 1 KB) as they come back from tool calls; per call setup
+// cost dominates here.
+static const std::vector<std::string> &smallDocuments() {
+  static const std::vector<std::string> documents = {
+      "{name: 'John', age: 30,}",
+      R"({"id": 1, "tags": ["a", "b" "c"], "ok": True})",
+      R"(```json
+{"tool": "search", "arguments": {"query": "weather in Paris", "limit": 5}}
+```)",
+      R"({"a": "foo" + "bar", "b": None, /* note */ "c": [1, 2, 3,]})",
+      R"([{"role": "user", "content": "Hi"}, {"role": "assistant", "content": "Hello! How can I help)",
+      R"({"translated_contents": [{"source": "TABLE 5. Finish time and throughput increase for HR and RR.", "translation": "表 5. HR 和 RR 的完成时间及吞吐量提升"}]})",
+      R"({"id": 1}
+{"id": 2}
+{"id": 3})",
+      R"({"user": {"name": "Ada", "email": "ada@example.com", "roles": ["admin", "dev"], "active": true, "score": 98.5, "meta": {"created": "2024-01-01", "tz": "UTC"}}})",
+  };
+  return documents;
+}
+
+static void reportLatency(const char *label, double seconds) {
+  std::printf("  %-34s %9.0f ns/doc\n", label, seconds * 1e9);
+}
+
+static void benchSmallDocuments() {
+  std::printf("small: documents under 1 KB\n");
+  const auto &documents = smallDocuments();
+  double seconds = secondsPerCall([&] {
+    for (const std::string &document : documents)
+      jsonrepair(document);
+  });
+  reportLatency("jsonrepair(std::string)",
+                seconds / static_cast<double>(documents.size()));
+
+  JSONRepairer repairer;
+  std::string out;
+  seconds = secondsPerCall([&] {
+    for (const std::string &document : documents) {
+      out.clear();
+      repairer.repair(document, out);
+    }
+  });
+  reportLatency("JSONRepairer, reused out",
+                seconds / static_cast<double>(documents.size()));
+}
+
+// Garbage that cannot be repaired, reported by exception and by status.
+static void benchErrors() {
+  std::printf("errors: unrepairable documents\n");
+  const std::vector<std::string> documents = {
+      "[1] x", "{\"a\" 1}", "{\"a\": 1, 2}", "\"\\u12z\"", "",
+      "Sorry, I cannot help with that request.",
+  };
+  double seconds = secondsPerCall([&] {
+    for (const std::string &document : documents) {
+      try {
+        jsonrepair(document);
+      } catch (const JSONRepairError &) {
+      }
+    }
+  });
+  reportLatency("jsonrepair, catching",
+                seconds / static_cast<double>(documents.size()));
+  seconds = secondsPerCall([&] {
+    for (const std::string &document : documents)
+      jsonrepair(document, std::nothrow);
+  });
+  reportLatency("jsonrepair(text, std::nothrow)",
+                seconds / static_cast<double>(documents.size()));
+}
+
+// An array of roughly `bytes` bytes with a missing comma on every line.
+static std::string missingCommas(size_t bytes) {
+  std::string text = "[\n";
+  for (size_t n = 0; text.size() < bytes; n++) {
+    text += "  {\"id\": " + std::to_string(n) + ", \"name\": \"item " +
+            std::to_string(n) + "\", \"score\": 0.5}\n";
+  }
+  text += "]\n";
+  return text;
+}
+
+static void benchScaling() {
+  std::printf("scaling: missing comma on every line\n");
+  for (size_t size : {size_t(1) << 20, size_t(10) << 20, size_t(100) << 20}) {
+    std::string text = missingCommas(size);
+    double seconds = secondsPerCall([&] { jsonrepair(text); });
+    char label[64];
+    std::snprintf(label, sizeof(label), "%zu MiB", text.size() >> 20);
+    std::printf("  %-34s %9.1f MB/s %9.2f ns/byte\n", label,
+                static_cast<double>(text.size()) / seconds / (1024.0 * 1024.0),
+                seconds * 1e9 / static_cast<double>(text.size()));
+  }
+}
+
+// The same records as llmPayload, written as valid JSON.
+static std::string validPayload(size_t bytes) {
+  std::string text = llmPayload(bytes);
+  for (size_t pos = 0; (pos = text.find("True", pos)) != std::string::npos;)
+    text.replace(pos, 4, "true");
+  text.resize(text.size() - 2); // trailing ",\n"
+  text += "\n]\n";
+  return text;
+}
+
+static void benchValidPassthrough() {
+  std::printf("valid: MB-sized payload that needs no repair\n");
+  std::string valid = validPayload(size_t(8) << 20);
+  std::string broken = llmPayload(valid.size());
+  std::string repaired;
+  reportThroughput("jsonrepair(std::string)", valid.size(),
+                   secondsPerCall([&] { jsonrepair(valid); }));
+  reportThroughput("jsonrepair(text, repaired)", valid.size(),
+                   secondsPerCall([&] { jsonrepair(valid, repaired); }));
+  reportThroughput("same size, needs repair", broken.size(),
+                   secondsPerCall([&] { jsonrepair(broken); }));
+}
+
+// Finding out what a document needs, against repairing it: broken
+// throughout, cut off near the end, and small.
+static void benchAnalysis() {
+  std::printf("analysis: jsonanalyze against a repair\n");
+  std::string broken = llmPayload(size_t(1) << 20);
+  std::string truncated = validPayload(size_t(1) << 20);
+  truncated.resize(truncated.size() - 100);
+  for (const std::string *text : {&broken, &truncated}) {
+    std::printf(" %s\n", text == &broken ? "broken throughout" : "truncated");
+    reportThroughput("jsonrepair(std::string)", text->size(),
+                     secondsPerCall([&] { jsonrepair(*text); }));
+    reportThroughput("jsonanalyze(std::string)", text->size(),
+                     secondsPerCall([&] { jsonanalyze(*text); }));
+  }
+  const auto &documents = smallDocuments();
+  double seconds = secondsPerCall([&] {
+    for (const std::string &document : documents)
+      jsonrepair(document);
+  });
+  reportLatency("jsonrepair, small documents",
+                seconds / static_cast<double>(documents.size()));
+  seconds = secondsPerCall([&] {
+    for (const std::string &document : documents)
+      jsonanalyze(document);
+  });
+  reportLatency("jsonanalyze, small documents",
+                seconds / static_cast<double>(documents.size()));
+}
+
+// `head` followed by `item` until the text has `bytes` bytes.
+static std::string repeated(const char *head, const char *item, size_t bytes) {
+  std::string text = head;
+  while (text.size() < bytes)
+    text += item;
+  return text;
+}
+
+// A 16 KB document arriving 4 bytes at a time, previewed after every piece:
+// the stream against repairing the text so far each time, for valid JSON,
+// for a document that needs repairs throughout and for a sequence of them.
+// The last three hold one value that the engine reads to the end of the
+// text, which every snapshot reads again from its start.
+static void benchStream() {
+  std::printf("stream: a preview after every 4 byte piece of 16 KB\n");
+  const size_t size = size_t(1) << 14;
+  std::string valid = validPayload(size);
+  std::string broken = llmPayload(size);
+  std::string sequence =
+      repeated("", "{'id': 1, 'tags': [True, None]}\n", size);
+  std::string quotes = repeated("[1, \"", "say \"hi\" ", size);
+  std::string chain = repeated("[1, \"a\"", " + \"a\"", size);
+  std::string comment = repeated("[1, /* ", "note ", size);
+  const std::pair<const char *, const std::string *> texts[] = {
+      {"valid", &valid},
+      {"broken throughout", &broken},
+      {"a sequence of broken documents", &sequence},
+      {"a string with inner quotes left open", &quotes},
+      {"a chain of strings joined with +", &chain},
+      {"a block comment left open", &comment},
+  };
+  const size_t piece = 4;
+  for (const auto &[name, text] : texts) {
+    std::printf(" %s\n", name);
+    const double previews = static_cast<double>(text->size() / piece);
+    double seconds = secondsPerCall([&] {
+      JSONRepairStream stream;
+      for (size_t k = 0; k < text->size(); k += piece) {
+        stream.append(text->data() + k, std::min(piece, text->size() - k));
+        stream.snapshot();
+      }
+    });
+    reportLatency("JSONRepairStream::snapshot", seconds / previews);
+    seconds = secondsPerCall([&] {
+      for (size_t k = piece; k <= text->size(); k += piece) {
+        jsonrepair(text->substr(0, k));
+      }
+    });
+    reportLatency("jsonrepair(text so far)", seconds / previews);
+  }
+}
+
+// A megabyte document cut off in a string: repairing it copies all of it,
+// completing it returns the few bytes that close it.
+static void benchCompletion() {
+  std::printf("completion: jsoncomplete against a repair\n");
+  std::string text = validPayload(size_t(1) << 20);
+  text.resize(text.rfind("\": \"") + 6);
+  reportThroughput("jsonrepair(std::string)", text.size(),
+                   secondsPerCall([&] { jsonrepair(text); }));
+  reportThroughput("jsoncomplete(std::string)", text.size(),
+                   secondsPerCall([&] { jsoncomplete(text); }));
+}
+
+// A megabyte document with a comment and a trailing comma: the repaired
+// copy against the edits that make it.
+static void benchEdits() {
+  std::printf("edits: jsonedits against a repair\n");
+  std::string text = "// generated\n" + validPayload(size_t(1) << 20);
+  text.insert(text.rfind(']'), ",");
+  reportThroughput("jsonrepair(std::string)", text.size(),
+                   secondsPerCall([&] { jsonrepair(text); }));
+  reportThroughput("jsonedits(std::string)", text.size(),
+                   secondsPerCall([&] { jsonedits(text); }));
+}
+
+// A megabyte payload repaired into a copy, and into a sink that drops each
+// part, for which the repair holds a few kilobytes at a time.
+static void benchSink() {
+  std::printf("sink: repair into a sink against a repaired copy\n");
+  std::string text = llmPayload(size_t(1) << 20);
+  JSONRepairFunctionSink<char> discard(
+      [](std::string_view part) { return !part.empty(); });
+  reportThroughput("jsonrepair(std::string)", text.size(),
+                   secondsPerCall([&] { jsonrepair(text); }));
+  reportThroughput("jsonrepair(std::string, sink)", text.size(),
+                   secondsPerCall([&] { jsonrepair(text, discard); }));
+}
+
+// An array of roughly `bytes` bytes whose elements are drawn at random from
+// `values`, so the kind of the next value cannot be predicted. The trailing
+// comma keeps the validator from passing it through.
+static std::string randomArray(const std::vector<const char *> &values,
+                               size_t bytes) {
+  std::string text = "[";
+  uint32_t state = 12345;
+  while (text.size() < bytes) {
+    state = state * 1103515245 + 12345;
+    text += values[(state >> 16) % values.size()];
+    text += ", ";
+  }
+  text += "]";
+  return text;
+}
+
+static void benchDispatch() {
+  std::printf("dispatch: arrays of unpredictable scalars\n");
+  const std::vector<const char *> numbers = {"0", "-1", "2.5", "-0.25",
+                                             "1e5", "42", "3.14159", ".5"};
+  const std::vector<const char *> keywords = {"true", "false", "null",
+                                              "True", "False", "None"};
+  std::vector<const char *> mixed = numbers;
+  mixed.insert(mixed.end(), keywords.begin(), keywords.end());
+  const std::pair<const char *, const std::vector<const char *> *> cases[] = {
+      {"numbers", &numbers}, {"keywords", &keywords}, {"mixed", &mixed}};
+  for (const auto &c : cases) {
+    std::string text = randomArray(*c.second, size_t(1) << 20);
+    reportThroughput(c.first, text.size(),
+                     secondsPerCall([&] { jsonrepair(text); }));
+  }
+}
+
+// Objects and arrays nested `depth` levels deep and never closed.
+static std::string deeplyNested(size_t depth) {
+  std::string text;
+  for (size_t level = 0; level < depth; level++)
+    text += level % 2 == 0 ? "{\"a\": " : "[1, ";
+  return text + "1";
+}
+
+static void benchNesting() {
+  std::printf("nesting: unclosed objects and arrays\n");
+  for (size_t depth : {size_t(10), size_t(1000), size_t(100000),
+                       size_t(1000000)}) {
+    std::string text = deeplyNested(depth);
+    char label[64];
+    std::snprintf(label, sizeof(label), "depth %zu", depth);
+    reportThroughput(label, text.size(), secondsPerCall([&] {
+                       jsonrepair(text, static_cast<int>(depth) + 1);
+                     }));
+  }
+}
+
+struct Benchmark {
+  const char *name;
+  void (*run)();
+};
+
+static const Benchmark benchmarks[] = {
+    {"utf8", benchUtf8Throughput},
+    {"small", benchSmallDocuments},
+    {"scaling", benchScaling},
+    {"valid", benchValidPassthrough},
+    {"dispatch", benchDispatch},
+    {"nesting", benchNesting},
+    {"errors", benchErrors},
+    {"analysis", benchAnalysis},
+    {"stream", benchStream},
+    {"completion", benchCompletion},
+    {"edits", benchEdits},
+    {"sink", benchSink},
+};
+
+int main(int argc, char **argv) {
+  for (const Benchmark &benchmark : benchmarks) {
+    bool selected = argc < 2;
+    for (int k = 1; k < argc; k++)
+      selected = selected || std::strcmp(argv[k], benchmark.name) == 0;
+    if (selected)
+      benchmark.run();
+  }
+  return 0;
+}
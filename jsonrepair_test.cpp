@@ -1,22 +1,1118 @@
 #include "jsonrepair/jsonrepair.hpp"
+#include "jsonrepair/utf8.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <new>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <vector>
+#if __has_include(<unistd.h>)
+#include <unistd.h>
+#endif
 
 extern std::vector<std::string> testdad;
 
+// Every heap allocation of the process, for checkAllocations.
+static size_t allocations = 0;
+
+void *operator new(size_t size) {
+  allocations++;
+  if (void *p = std::malloc(size != 0 ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+
+// Repairs through the UTF-16 and UTF-32 engines and returns UTF-8, or the
+// error message.
+static std::string repairUtf16(const std::string &text) {
+  std::u16string input;
+  utf8::utf8to16(text.begin(), text.end(), std::back_inserter(input));
+  try {
+    std::u16string output = jsonrepair(input, 10);
+    std::string rs;
+    utf8::utf16to8(output.begin(), output.end(), std::back_inserter(rs));
+    return rs;
+  } catch (const JSONRepairError &e) {
+    return e.what();
+  }
+}
+
+static std::string repairUtf32(const std::string &text) {
+  std::u32string input;
+  utf8::utf8to32(text.begin(), text.end(), std::back_inserter(input));
+  try {
+    std::u32string output = jsonrepair(input, 10);
+    std::string rs;
+    utf8::utf32to8(output.begin(), output.end(), std::back_inserter(rs));
+    return rs;
+  } catch (const JSONRepairError &e) {
+    return e.what();
+  }
+}
+
+// The repair of `text` through the engine for `CharT` as UTF-8, or the
+// error, without its position, which counts that engine's code units.
+template <typename CharT> static std::string repairedAs(const std::string &text) {
+  std::basic_string<CharT> input;
+  if constexpr (sizeof(CharT) == 1)
+    input = text;
+  else if constexpr (sizeof(CharT) == 2)
+    utf8::utf8to16(text.begin(), text.end(), std::back_inserter(input));
+  else
+    utf8::utf8to32(text.begin(), text.end(), std::back_inserter(input));
+  JSONRepairOptions options;
+  options.maxDepth = 10;
+  auto result = jsonrepair(std::basic_string_view<CharT>(input), std::nothrow,
+                           options);
+  if (!result)
+    return "error " + std::to_string(static_cast<int>(result.error));
+  std::string rs;
+  if constexpr (sizeof(CharT) == 1)
+    rs = result.output;
+  else if constexpr (sizeof(CharT) == 2)
+    utf8::utf16to8(result.output.begin(), result.output.end(),
+                   std::back_inserter(rs));
+  else
+    utf8::utf32to8(result.output.begin(), result.output.end(),
+                   std::back_inserter(rs));
+  return rs;
+}
+
+// Deterministic inputs built from JSON syntax, the quotes and spaces the
+// engine replaces, and other characters of two to four UTF-8 bytes.
+static std::vector<std::string> nonAsciiInputs(size_t count) {
+  static const char *const pieces[] = {
+      "{",  "}",      "[",      "]",      ",",      ":",     "\"",  "'",
+      " ",  "\n",     "a",      "1",      "e",      ".",     "+",   "\\",
+      "True", "null", "/*c*/", "//c\n", "...",   "f(",    ")",   "`",
+      "\u201c", "\u201d", "\u2018", "\u2019", "\u00a0", "\u3000", "\u2003",
+      "\u00e9", "\u8868", "\U0001F600",
+  };
+  const size_t n = sizeof pieces / sizeof pieces[0];
+  std::vector<std::string> inputs;
+  uint32_t seed = 12345;
+  for (size_t k = 0; k < count; k++) {
+    std::string text;
+    seed = seed * 1103515245 + 12345;
+    for (size_t m = 1 + (seed >> 16) % 12; m > 0; m--) {
+      seed = seed * 1103515245 + 12345;
+      text += pieces[(seed >> 16) % n];
+    }
+    inputs.push_back(text);
+  }
+  return inputs;
+}
+
+static std::string repeat(const std::string &s, size_t count) {
+  std::string rs;
+  for (size_t k = 0; k < count; k++)
+    rs += s;
+  return rs;
+}
+
+template <typename Repair>
+static double secondsToRepair(const std::string &text, Repair repair) {
+  double best = 1e9;
+  for (int run = 0; run < 3; run++) {
+    auto start = std::chrono::steady_clock::now();
+    try {
+      repair(text);
+    } catch (const JSONRepairError &) {
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    best = std::min(best, elapsed.count());
+  }
+  return best;
+}
+
+static double secondsToRepair(const std::string &text) {
+  return secondsToRepair(text, [](const std::string &t) { jsonrepair(t); });
+}
+
+// Strings full of unescaped quotes and commas used to be rescanned from
+// their opening quote. Growing the input 8x must not grow the time by more
+// than a linear factor (a quadratic scan would be 64x).
+static int checkLinearStrings() {
+  const std::vector<std::function<std::string(size_t)>> adversarial = {
+      [](size_t k) {
+        return "{\"text\": \"" +
+               repeat("He said \"hi, \"there\" and \"more, ", k) + "\"}";
+      },
+      [](size_t k) { return "[\"x" + repeat(", \"y\" z", k) + "]"; },
+      [](size_t k) { return "[" + repeat("\"a \"b ", k) + ","; },
+      [](size_t k) { return "[\"a " + repeat("\" /* ", k) + "*/ x]"; },
+  };
+  int failures = 0;
+  for (size_t n = 0; n < adversarial.size(); n++) {
+    double small = secondsToRepair(adversarial[n](2000));
+    double large = secondsToRepair(adversarial[n](16000));
+    if (large > 24 * small + 0.01) {
+      std::cerr << "adversarial input " << n << " scales superlinearly: "
+                << small << "s -> " << large << "s\n";
+      failures++;
+    }
+  }
+  return failures;
+}
+
+// Edits, and the in-place repair that works from them, remove the opening
+// quotes of a long concatenation in one pass as well.
+static int checkLinearEdits() {
+  auto chain = [](size_t k) {
+    return "[\"a\"" + repeat(" + \"a\"", k) + "]";
+  };
+  auto edits = [](const std::string &t) { jsonedits(t); };
+  auto inPlace = [](const std::string &t) { jsonrepair(std::string(t)); };
+  int failures = 0;
+  if (secondsToRepair(chain(16000), edits) >
+      24 * secondsToRepair(chain(2000), edits) + 0.01) {
+    std::cerr << "edits of a concatenation scale superlinearly\n";
+    failures++;
+  }
+  if (secondsToRepair(chain(16000), inPlace) >
+      24 * secondsToRepair(chain(2000), inPlace) + 0.01) {
+    std::cerr << "in-place repair of a concatenation scales superlinearly\n";
+    failures++;
+  }
+  return failures;
+}
+
+// Valid documents come back byte for byte, even where the engine would have
+// rewritten them; anything else goes through the engine.
+static int checkPassthrough() {
+  const std::vector<std::string> valid = {
+      R"({"text": "it's", "quote": "\u201c\"”", "n": -0.5e+3})",
+      " [true, false, null, {}, [], \"\\/\"]\n",
+      "\"😀\"",
+  };
+  const std::vector<std::string> invalid = {
+      "[1,]", "{\"a\": 01}", "\"\\u12\"", "[1] x", "\"tab\there\"",
+      "{'a': 1}", "[1", "",
+  };
+  int failures = 0;
+  for (const std::string &v : valid) {
+    std::string repaired = "untouched";
+    if (jsonrepair(v, 10) != v || jsonrepair(v, repaired, 10) ||
+        repaired != "untouched") {
+      std::cerr << "valid document was rewritten: " << v << "\n";
+      failures++;
+    }
+  }
+  for (const std::string &v : invalid) {
+    std::string repaired;
+    try {
+      if (!jsonrepair(v, repaired, 10)) {
+        std::cerr << "invalid document passed through: " << v << "\n";
+        failures++;
+      }
+    } catch (const JSONRepairError &) {
+    }
+  }
+  // Nesting beyond maxDepth is rejected just like the engine rejects it.
+  try {
+    jsonrepair(std::string(11, '[') + "1" + std::string(11, ']'), 10);
+    std::cerr << "nesting beyond maxDepth passed through\n";
+    failures++;
+  } catch (const JSONRepairError &) {
+  }
+  return failures;
+}
+
+// A repair allocates for the growth of its output only, a few dozen times
+// for a document of any size, whatever repairs it needs.
+template <typename StringT>
+static int checkAllocationsOf(const char *name, const StringT &document) {
+  size_t before = allocations;
+  StringT repaired = jsonrepair(document);
+  size_t count = allocations - before;
+  if (count > 32) {
+    std::cerr << name << " repair made " << count << " allocations\n";
+    return 1;
+  }
+  return 0;
+}
+
+// A document that needs most kinds of repair, `count` objects long.
+static std::string manyRepairs(size_t count) {
+  return "```json\n[\n" +
+         repeat("  {id: 1, 'name': 'item', \"score\": 007, "
+                "\"ok\": True, \"none\": None, \"re\": /a+b/, "
+                "\"url\": http://example.com/x, u: undefined, "
+                "\"s\": \"a\" + \"b\", \"t\": \"He said \"hi\"\" "
+                "\"n\": -.5e, /* c */ x: [1 2 ...]}\n",
+                count) +
+         "```";
+}
+
+static int checkAllocations() {
+  std::string document = manyRepairs(1000);
+  std::u16string utf16;
+  utf8::utf8to16(document.begin(), document.end(), std::back_inserter(utf16));
+  std::u32string utf32;
+  utf8::utf8to32(document.begin(), document.end(), std::back_inserter(utf32));
+  int failures = checkAllocationsOf("UTF-8", document) +
+                 checkAllocationsOf("UTF-16", utf16) +
+                 checkAllocationsOf("UTF-32", utf32);
+  // A small document needs one allocation at most: its result.
+  for (const std::string &v : testdad) {
+    if (v.size() >= 512)
+      continue;
+    size_t before = allocations;
+    size_t count = 0;
+    try {
+      std::string repaired = jsonrepair(v, 10);
+      count = allocations - before;
+    } catch (const JSONRepairError &) {
+      continue;
+    }
+    if (count > 1) {
+      std::cerr << "small repair made " << count << " allocations: " << v
+                << "\n";
+      failures++;
+    }
+  }
+  return failures;
+}
+
+// Nesting does not grow the native stack: objects, arrays, function calls
+// and string chains far deeper than any stack could hold a frame for each.
+static int checkDeepNesting() {
+  const size_t depth = 200000;
+  const int maxDepth = static_cast<int>(2 * depth);
+  const std::vector<std::pair<std::string, std::string>> cases = {
+      {repeat("[", depth) + "1", repeat("[", depth) + "1" + repeat("]", depth)},
+      {repeat("{\"a\": ", depth) + "1",
+       repeat("{\"a\": ", depth) + "1" + repeat("}", depth)},
+      {repeat("f(", depth) + "1", "1"},
+      {repeat("{f(", depth) + "1",
+       repeat("{", depth) + "1" + repeat(":null}", depth)},
+      {"[" + repeat("\"a\" + ", depth) + "\"b\"",
+       "[\"" + repeat("a  ", depth) + "b\"]"},
+  };
+  int failures = 0;
+  for (const auto &c : cases) {
+    if (jsonrepair(c.first, maxDepth) != c.second) {
+      std::cerr << "deep nesting repaired wrongly: " << c.first.substr(0, 16)
+                << "...\n";
+      failures++;
+    }
+  }
+  return failures;
+}
+
+// Each budget stops a repair with its own limit, and documents within every
+// budget repair as usual.
+static int checkBudgets() {
+  using Limit = JSONRepairLimitError::Limit;
+  const std::string large = "[" + repeat("1, ", 100000) + "1";
+  JSONRepairCancellation cancelled;
+  cancelled.cancel();
+  const auto limited = [](auto configure) {
+    JSONRepairOptions options;
+    configure(options);
+    return options;
+  };
+  const std::vector<std::pair<JSONRepairOptions, Limit>> cases = {
+      {limited([](auto &o) { o.maxInputSize = 1000; }), Limit::InputSize},
+      {limited([](auto &o) { o.maxOutputRatio = 0.5; }), Limit::OutputSize},
+      {limited([](auto &o) { o.maxSteps = 1000; }), Limit::Steps},
+      {limited([](auto &o) { o.deadline = std::chrono::steady_clock::now(); }),
+       Limit::Deadline},
+      {limited([&](auto &o) { o.cancellation = &cancelled; }),
+       Limit::Cancelled},
+  };
+  int failures = 0;
+  for (size_t k = 0; k < cases.size(); k++) {
+    try {
+      jsonrepair(large, cases[k].first);
+      std::cerr << "budget " << k << " did not stop the repair\n";
+      failures++;
+    } catch (const JSONRepairLimitError &e) {
+      if (e.limit != cases[k].second) {
+        std::cerr << "budget " << k << " reported another limit\n";
+        failures++;
+      }
+    }
+  }
+  // Valid JSON, which no entry point repairs, is read under them as well.
+  const std::string valid = large + "]";
+  JSONRepairFunctionSink<char> discard([](std::string_view) { return true; });
+  for (size_t k = 2; k < cases.size(); k++) {
+    const JSONRepairOptions &options = cases[k].first;
+    JSONRepairErrorCode expected =
+        jsonrepair(large, std::nothrow, options).error;
+    bool inPlaceStopped = false;
+    try {
+      jsonrepair(std::string(valid), options);
+    } catch (const JSONRepairLimitError &e) {
+      inPlaceStopped = e.limit == cases[k].second;
+    }
+    if (expected == JSONRepairErrorCode::None ||
+        jsonrepair(valid, std::nothrow, options).error != expected ||
+        jsonanalyze(valid, options).error != expected ||
+        jsoncomplete(valid, options).error != expected ||
+        jsonedits(valid, options).error != expected ||
+        jsonrepair(valid, discard, options).error != expected ||
+        !inPlaceStopped) {
+      std::cerr << "budget " << k << " did not stop reading valid JSON\n";
+      failures++;
+    }
+  }
+  JSONRepairOptions generous;
+  generous.maxInputSize = large.size();
+  generous.maxOutputRatio = 1.5;
+  generous.maxSteps = 1000000;
+  generous.deadline = std::chrono::steady_clock::now() + std::chrono::hours(1);
+  JSONRepairCancellation idle;
+  generous.cancellation = &idle;
+  if (jsonrepair(large, generous) != large + "]" ||
+      jsonrepair(std::string("{"), generous) != "{}") {
+    std::cerr << "budgets changed a repair within them\n";
+    failures++;
+  }
+  return failures;
+}
+
+// A repair under a memory resource takes nothing from the global heap or the
+// default resource. Neither the arena nor the default resource have memory
+// to give beyond the arena, so a stray allocation from them throws.
+static int checkMemoryResource() {
+  int failures = 0;
+#if defined(__cpp_lib_memory_resource)
+  const std::vector<std::string> documents = {
+      manyRepairs(1000),
+      repeat("{f(", 1000) + "1",
+      "[" + repeat("\"a\" + ", 1000) + "\"b\"",
+      "{\"valid\": [1, 2, 3]}",
+  };
+  std::vector<char> arena(size_t(16) << 20);
+  for (const std::string &document : documents) {
+    const std::string expected = jsonrepair(document, 2000);
+    std::u16string utf16;
+    utf8::utf8to16(document.begin(), document.end(),
+                   std::back_inserter(utf16));
+    const std::u16string expected16 = jsonrepair(utf16, 2000);
+    std::pmr::monotonic_buffer_resource resource(
+        arena.data(), arena.size(), std::pmr::null_memory_resource());
+    JSONRepairOptions options;
+    options.maxDepth = 2000;
+
+    std::pmr::memory_resource *previous =
+        std::pmr::set_default_resource(std::pmr::null_memory_resource());
+    size_t before = allocations;
+    std::pmr::string repaired(&resource);
+    std::pmr::u16string repaired16(&resource);
+    try {
+      repaired = jsonrepair(document, &resource, options);
+      repaired16 = jsonrepair(utf16, &resource, options);
+    } catch (const std::bad_alloc &) {
+      std::cerr << "repair under a memory resource used another resource\n";
+      failures++;
+    }
+    size_t count = allocations - before;
+    std::pmr::set_default_resource(previous);
+    if (count != 0) {
+      std::cerr << "repair under a memory resource made " << count
+                << " heap allocations\n";
+      failures++;
+    }
+    if (std::string_view(repaired) != expected ||
+        std::u16string_view(repaired16) != expected16) {
+      std::cerr << "repair under a memory resource differs: "
+                << document.substr(0, 16) << "...\n";
+      failures++;
+    }
+  }
+#endif
+  return failures;
+}
+
+// A JSONRepairer appends what jsonrepair returns, and once warmed up it
+// repairs without allocating when `out` has room.
+static int checkRepairer() {
+  const std::vector<std::string> documents = {
+      manyRepairs(100), repeat("[", 500) + "1", repeat("{f(", 200) + "1",
+      "[" + repeat("\"a\" + ", 200) + "\"b\"",
+      repeat("{\"a\": [", 100) + "1" + repeat("]}", 100), "{'a': 1}"};
+  JSONRepairOptions options;
+  options.maxDepth = 1000;
+  JSONRepairer repairer(options);
+  std::string out;
+  out.reserve(size_t(1) << 20);
+  int failures = 0;
+  for (int round = 0; round < 2; round++) {
+    for (const std::string &document : documents) {
+      std::string expected = jsonrepair(document, options.maxDepth);
+      out.assign("prefix");
+      size_t before = allocations;
+      repairer.repair(document, out);
+      size_t count = allocations - before;
+      if (out.compare(0, 6, "prefix") != 0 ||
+          out.compare(6, std::string::npos, expected) != 0) {
+        std::cerr << "JSONRepairer repaired wrongly: "
+                  << document.substr(0, 16) << "...\n";
+        failures++;
+      }
+      if (round == 1 && count != 0) {
+        std::cerr << "warm JSONRepairer made " << count << " allocations\n";
+        failures++;
+      }
+    }
+  }
+#if defined(__cpp_char8_t)
+  // char8_t text is repaired in the same buffers, without a copy of its own.
+  std::u8string u8out;
+  u8out.reserve(size_t(1) << 20);
+  for (int round = 0; round < 2; round++) {
+    for (const std::string &document : documents) {
+      std::string expected = jsonrepair(document, options.maxDepth);
+      u8out.clear();
+      size_t before = allocations;
+      repairer.repair(std::u8string_view(reinterpret_cast<const char8_t *>(
+                                             document.data()),
+                                         document.size()),
+                      u8out);
+      size_t count = allocations - before;
+      if (std::string(u8out.begin(), u8out.end()) != expected ||
+          (round == 1 && count != 0)) {
+        std::cerr << "warm char8_t JSONRepairer made " << count
+                  << " allocations\n";
+        failures++;
+      }
+    }
+  }
+#endif
+  try {
+    out.assign("kept");
+    repairer.repair(std::string("[1] x"), out);
+    std::cerr << "JSONRepairer accepted an unrepairable document\n";
+    failures++;
+  } catch (const JSONRepairError &) {
+    if (out != "kept") {
+      std::cerr << "failed JSONRepairer repair changed out\n";
+      failures++;
+    }
+  }
+  return failures;
+}
+
+// The non-throwing API reports what the throwing one throws: the same
+// output, or the same error at the same position.
+static int checkNoThrow() {
+  int failures = 0;
+  std::vector<std::string> cases = testdad;
+  cases.push_back("[1] 😀");
+  cases.push_back("{\"a\" 1}");
+  cases.push_back(repeat("[", 20) + "1");
+  for (const std::string &v : cases) {
+    JSONRepairOptions options;
+    options.maxDepth = 10;
+    JSONRepairResult<std::string> result = jsonrepair(v, std::nothrow, options);
+    std::string thrown;
+    std::string fixed;
+    size_t position = 0;
+    try {
+      fixed = jsonrepair(v, 10);
+    } catch (const JSONRepairError &e) {
+      thrown = e.what();
+      position = e.position;
+    }
+    bool agree = thrown.empty()
+                     ? result && result.output == fixed
+                     : !result && result.output.empty() &&
+                           result.position == position &&
+                           thrown.compare(0, std::strlen(result.message),
+                                          result.message) == 0;
+    if (!agree) {
+      std::cerr << "nothrow repair disagrees on: " << v << "\n";
+      failures++;
+    }
+  }
+  // A character outside the BMP is named whole in UTF-16 error messages.
+  std::u16string astral = u"[1] \U0001F600";
+  try {
+    jsonrepair(astral);
+    std::cerr << "UTF-16 text after the document was accepted\n";
+    failures++;
+  } catch (const JSONRepairError &e) {
+    if (std::string(e.what()) != "Unexpected character 😀 at position 4") {
+      std::cerr << "UTF-16 error message: " << e.what() << "\n";
+      failures++;
+    }
+  }
+  JSONRepairOptions limited;
+  limited.maxSteps = 10;
+  JSONRepairer repairer(limited);
+  std::string out = "kept";
+  JSONRepairStatus status =
+      repairer.repair("[" + repeat("1, ", 100), out, std::nothrow);
+  if (status || status.error != JSONRepairErrorCode::StepLimit ||
+      out != "kept") {
+    std::cerr << "nothrow JSONRepairer missed the step limit\n";
+    failures++;
+  }
+  return failures;
+}
+
+static int checkLenient() {
+  int failures = 0;
+  JSONRepairOptions lenient;
+  lenient.lenient = true;
+  std::vector<std::string> cases = testdad;
+  cases.push_back("{\"a\":1, @@@, \"b\":2}");
+  cases.push_back("{\"a\" ) 1, :2}");
+  cases.push_back("[1] xyz {\"b\":2}");
+  // A function call around nothing, with the rest skipped, keeps no value.
+  cases.push_back("xcallback(}\u201d\"a\"0+ ");
+  cases.push_back("f(} x");
+  for (const std::string &v : cases) {
+    JSONRepairResult<std::string> strict = jsonrepair(v, std::nothrow);
+    JSONRepairResult<std::string> result = jsonrepair(v, std::nothrow, lenient);
+    JSONRepairResult<std::string> again =
+        jsonrepair(result.output, std::nothrow);
+    // What repairs anyway repairs the same; the rest comes out valid, as a
+    // document that repairs to itself, or fails as the strict repair does.
+    bool agree = strict ? result && result.output == strict.output &&
+                              result.unrecoverable.empty()
+                        : result ? !result.unrecoverable.empty() && again &&
+                                       again.output == result.output
+                                 : result.error == strict.error &&
+                                       result.position == strict.position;
+    if (!agree) {
+      std::cerr << "lenient repair of: " << v << " gave " << result.output
+                << "\n";
+      failures++;
+    }
+  }
+  JSONRepairResult<std::string> result =
+      jsonrepair(std::string("{\"a\" ) 1, :2} tail"), std::nothrow, lenient);
+  if (result.output != "{\"a\": 1 } " || result.unrecoverable.size() != 3 ||
+      result.unrecoverable[0].error != JSONRepairErrorCode::ColonExpected ||
+      result.unrecoverable[0].position != 5 ||
+      result.unrecoverable[0].length != 2 ||
+      result.unrecoverable[1].error != JSONRepairErrorCode::ObjectKeyExpected ||
+      result.unrecoverable[1].position != 10 ||
+      result.unrecoverable[2].error !=
+          JSONRepairErrorCode::UnexpectedCharacter ||
+      result.unrecoverable[2].position != 14 ||
+      result.unrecoverable[2].length != 4) {
+    std::cerr << "lenient repair reported: " << result.output << "\n";
+    failures++;
+  }
+  return failures;
+}
+
+static int checkAnalysis() {
+  int failures = 0;
+  std::vector<std::string> cases = testdad;
+  cases.push_back("{\"a\": [1, 2], \"b\": \"it's\"}");
+  cases.push_back("[1, \"it's\", {\"a\": 2}, 3");
+  cases.push_back("{\"a\": [1, 2], \"b\": {\"c\": \"x\"}, \"d\": [tru");
+  // Valid stretches between repairs, which the analysis passes over.
+  cases.push_back("[True, {\"a\": [1, \"x\"], \"b\": \"it's\"}, "
+                  "{\"c\": [2, 3], \"d\": None}, [4, 5] 6, \"y\", \"z");
+  cases.push_back("{\"a\": True, \"b\": [1, \"x\", {\"c\": \"d\"}], "
+                  "\"e\": \"one\", \"f\": \"two\" + \"three\"}");
+  for (const std::string &v : cases) {
+    JSONRepairResult<std::string> result = jsonrepair(v, std::nothrow);
+    JSONRepairAnalysis analysis = jsonanalyze(v);
+    // Same verdict as the repair, and a change has a category to show.
+    bool agree = analysis.error == result.error &&
+                 analysis.position == result.position &&
+                 (!result || analysis.needsRepair() == (result.output != v));
+    if (!agree) {
+      std::cerr << "analysis disagrees on: " << v << "\n";
+      failures++;
+    }
+  }
+  JSONRepairAnalysis valid = jsonanalyze(std::string("{\"a\": [1, \"‘x’\"]}"));
+  JSONRepairAnalysis object = jsonanalyze(std::string("{a: 1,}"));
+  JSONRepairAnalysis wide = jsonanalyze(std::u16string(u"{a: 1,}"));
+  JSONRepairAnalysis truncated =
+      jsonanalyze(std::string("{\"a\": [1, 2], \"b\": \"x"));
+  JSONRepairAnalysis later = jsonanalyze(std::string(
+      "[True, {\"a\": [1, \"x\"], \"b\": \"y\"}, {\"c\": 2, \"d\": 'z'}]"));
+  if (!valid || valid.needsRepair() || !object ||
+      object.categories !=
+          ((1u << static_cast<int>(JSONRepairCategory::UnquotedString)) |
+           (1u << static_cast<int>(JSONRepairCategory::RedundantComma))) ||
+      object.firstPosition(JSONRepairCategory::UnquotedString) != 1 ||
+      object.firstPosition(JSONRepairCategory::RedundantComma) != 6 ||
+      wide.categories != object.categories ||
+      !truncated.needs(JSONRepairCategory::MissingQuote) ||
+      !truncated.needs(JSONRepairCategory::MissingBracket) ||
+      truncated.needs(JSONRepairCategory::MissingComma) ||
+      later.firstPosition(JSONRepairCategory::Keyword) != 1 ||
+      later.firstPosition(JSONRepairCategory::Quote) != 48) {
+    std::cerr << "analysis reported: " << object.categories << " "
+              << truncated.categories << "\n";
+    failures++;
+  }
+  return failures;
+}
+
+static int checkStream() {
+  int failures = 0;
+  JSONRepairStream stream;
+  // Whole documents, fed a few bytes at a time, end up repaired as in one
+  // go. A key the engine reads differently, with a quote character in it,
+  // holds no resume point after it.
+  std::vector<std::string> documents = testdad;
+  documents.push_back("{\"]\u201d\":1,,\"b\":2}");
+  for (size_t piece : {1, 3, 4}) {
+    for (const std::string &v : documents) {
+      stream.clear();
+      for (size_t k = 0; k < v.size(); k += piece) {
+        stream.append(std::string_view(v).substr(k, piece));
+        stream.snapshot(std::nothrow);
+      }
+      JSONRepairResult<std::string> whole = jsonrepair(v, std::nothrow);
+      JSONRepairStatus status = stream.snapshot(std::nothrow);
+      if (status.error != whole.error || stream.output() != whole.output) {
+        std::cerr << "stream repair of: " << v << " gave "
+                  << stream.output() << "\n";
+        failures++;
+      }
+    }
+  }
+  // A character split between pieces waits for its last byte.
+  stream.clear();
+  std::string split;
+  for (const char *piece : {"[\"\xE8", "\xA1", "\xA8"}) {
+    stream.append(piece, std::strlen(piece));
+    split += stream.snapshot() + " ";
+  }
+  if (split != "[\"\"] [\"\"] [\"\xE8\xA1\xA8\"] ") {
+    std::cerr << "stream split a character: " << split << "\n";
+    failures++;
+  }
+  // Text that needs repairs from its start is not repaired again from there
+  // on every snapshot: eight times the text takes about eight times as long.
+  // So does a sequence of such documents, one per line.
+  auto secondsToStream = [&](size_t items, bool sequence, bool compare) {
+    std::string text = sequence ? "" : "{'items': [";
+    for (size_t k = 0; k < items; k++)
+      text += "{\"id\": " + std::to_string(k) + ", 'tags': [True, None]}" +
+              (sequence ? "\n" : ", ");
+    stream.clear();
+    auto start = std::chrono::steady_clock::now();
+    for (size_t k = 0; k < text.size(); k += 4) {
+      stream.append(std::string_view(text).substr(k, 4));
+      stream.snapshot(std::nothrow);
+      if (compare && stream.output() != jsonrepair(stream.text())) {
+        std::cerr << "stream snapshot of: " << stream.text() << " gave "
+                  << stream.output() << "\n";
+        failures++;
+        break;
+      }
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+  };
+  for (bool sequence : {false, true}) {
+    secondsToStream(100, sequence, true);
+    double small = secondsToStream(500, sequence, false);
+    double large = secondsToStream(4000, sequence, false);
+    if (large > 24 * small + 0.01) {
+      std::cerr << "stream snapshots scale superlinearly: " << small
+                << "s -> " << large << "s\n";
+      failures++;
+    }
+  }
+  // Every prefix of valid JSON comes out valid, ending in the text so far.
+  const std::string document =
+      "```json\n{\"a\": [1, -2.5e3, {\"b\": \"it's \\\"x\\u00e9\"}], "
+      "\"c\": true, \"d\": {}}";
+  stream.clear();
+  const std::string prefix = "\n{\"a\": [1, -2.5e3, {\"b\": \"it's \\\"x";
+  stream.append(document.data(), 8);
+  for (size_t k = 8; k < document.size(); k++) {
+    stream.append(document.substr(k, 1));
+    std::string repaired;
+    try {
+      if (jsonrepair(stream.snapshot(), repaired)) {
+        std::cerr << "stream snapshot is not valid: " << stream.output()
+                  << "\n";
+        failures++;
+      }
+    } catch (const JSONRepairError &e) {
+      std::cerr << "stream snapshot of: " << stream.text() << ": " << e.what()
+                << "\n";
+      failures++;
+    }
+    if (stream.text().size() == document.find("\\u") &&
+        stream.output() != prefix + "\"}]}") {
+      std::cerr << "stream closed: " << stream.output() << "\n";
+      failures++;
+    }
+  }
+  if (stream.output() != document.substr(7)) {
+    std::cerr << "stream ended with: " << stream.output() << "\n";
+    failures++;
+  }
+  return failures;
+}
+
+static int checkCompletion() {
+  int failures = 0;
+  std::vector<std::string> cases = testdad;
+  cases.push_back("{\"a\": [1, {\"b\": \"it's");
+  cases.push_back("{a: 1, \"b\": [2, 3");
+  for (const std::string &v : cases) {
+    // The cut and the append make up the repair, and fail with it.
+    for (size_t k = 0; k <= v.size(); k++) {
+      std::string text = v.substr(0, k);
+      JSONRepairResult<std::string> result = jsonrepair(text, std::nothrow);
+      JSONRepairCompletion<std::string> completion = jsoncomplete(text);
+      if (completion.error != result.error ||
+          completion.position != result.position ||
+          completion.keep > text.size() ||
+          (result && text.substr(0, completion.keep) + completion.suffix !=
+                         result.output)) {
+        std::cerr << "completion of: " << text << " kept " << completion.keep
+                  << " of it, then " << completion.suffix << "\n";
+        failures++;
+      }
+    }
+  }
+  const std::string truncated = "{\"a\": [1, {\"b\": \"te";
+  const std::string valid = "{\"a\": [1, {\"b\": \"text\"}]}";
+  JSONRepairCompletion<std::string> closed = jsoncomplete(truncated);
+  JSONRepairCompletion<std::string> whole = jsoncomplete(valid);
+  JSONRepairCompletion<std::u16string> wide =
+      jsoncomplete(std::u16string(u"[1, 2, \"x"));
+  if (closed.keep != truncated.size() || closed.suffix != "\"}]}" ||
+      whole.keep != valid.size() || !whole.suffix.empty() || wide.keep != 9 ||
+      wide.suffix != u"\"]") {
+    std::cerr << "completion closed with: " << closed.suffix << "\n";
+    failures++;
+  }
+  return failures;
+}
+
+// Applies `edits` to `text`, or returns "?" when they are out of order.
+static std::string applyEdits(
+    const std::string &text,
+    const std::vector<JSONRepairEdit<std::string>> &edits) {
+  std::string out;
+  size_t at = 0;
+  for (const JSONRepairEdit<std::string> &edit : edits) {
+    if (edit.offset < at || edit.offset + edit.length > text.size())
+      return "?";
+    out.append(text, at, edit.offset - at);
+    out += edit.text;
+    at = edit.offset + edit.length;
+  }
+  out.append(text, at, std::string::npos);
+  return out;
+}
+
+static int checkEdits() {
+  int failures = 0;
+  for (const std::string &v : testdad) {
+    // The edits make the text the repair, and fail with it.
+    for (size_t k = 0; k <= v.size(); k++) {
+      std::string text = v.substr(0, k);
+      JSONRepairResult<std::string> result = jsonrepair(text, std::nothrow);
+      JSONRepairEdits<std::string> edits = jsonedits(text);
+      if (edits.error != result.error || edits.position != result.position ||
+          (result && applyEdits(text, edits.edits) != result.output)) {
+        std::cerr << "edits of: " << text << " gave "
+                  << applyEdits(text, edits.edits) << "\n";
+        failures++;
+      }
+    }
+  }
+  // Repairs that keep the text around them keep it out of the edits.
+  JSONRepairEdits<std::string> quotes =
+      jsonedits(std::string("{'a': \u2018x\u2019}"));
+  JSONRepairEdits<std::string> commas =
+      jsonedits(std::string("{\"a\" 1 \"b\" 2}"));
+  JSONRepairEdits<std::string> valid = jsonedits(std::string("[1, {}]"));
+  JSONRepairEdits<std::u16string> wide = jsonedits(std::u16string(u"[1 2"));
+  bool small = quotes.edits.size() == 4 && commas.edits.size() == 3;
+  for (const auto &edit : quotes.edits)
+    small = small && edit.text == "\"";
+  if (!small || commas.edits[0].offset != 4 || commas.edits[0].length != 0 ||
+      commas.edits[0].text != ":" || !valid || !valid.edits.empty() ||
+      wide.edits.size() != 2 || wide.edits[1].offset != 4 ||
+      wide.edits[1].text != u"]") {
+    std::cerr << "edits: " << quotes.edits.size() << " "
+              << commas.edits.size() << "\n";
+    failures++;
+  }
+  return failures;
+}
+
+static std::string repairOrError(const std::string &text, bool inPlace) {
+  try {
+    return inPlace ? jsonrepair(std::string(text), 10) : jsonrepair(text, 10);
+  } catch (const JSONRepairError &e) {
+    return std::string(e.what()) + " @" + std::to_string(e.position);
+  }
+}
+
+static int checkInPlace() {
+  int failures = 0;
+  for (const std::string &v : testdad) {
+    if (repairOrError(v, true) != repairOrError(v, false)) {
+      std::cerr << "in-place repair of: " << v << " gave "
+                << repairOrError(v, true) << "\n";
+      failures++;
+    }
+  }
+  // A large document with a few repairs is repaired in its storage, with a
+  // few small allocations for the repairs.
+  std::string document = "// generated\n[\n" +
+                         repeat("  {\"id\": 1, \"name\": \"item\"},\n", 20000) +
+                         "]\n";
+  std::string expected = jsonrepair(document);
+  const char *storage = document.data();
+  size_t before = allocations;
+  std::string repaired = jsonrepair(std::move(document));
+  size_t count = allocations - before;
+  if (repaired != expected || repaired.data() != storage || count > 8) {
+    std::cerr << "in-place repair made " << count << " allocations\n";
+    failures++;
+  }
+  // One with a repair in every few characters is built anew instead, with
+  // the same result.
+  std::string dense = "[" + repeat("{a: 1, b: 'x', c: True}\n", 20000) + "]";
+  expected = jsonrepair(std::string_view(dense));
+  if (jsonrepair(std::move(dense)) != expected) {
+    std::cerr << "in-place repair of a dense document differs\n";
+    failures++;
+  }
+  std::u16string grown = jsonrepair(std::u16string(u"{a: [1 2 3], b: 'x'}"));
+  if (grown != u"{\"a\": [1, 2, 3], \"b\": \"x\"}") {
+    std::cerr << "in-place repair grew wrong\n";
+    failures++;
+  }
+  return failures;
+}
+
+// Text that is part of a larger buffer is repaired where it is, and
+// positions count from its start.
+static int checkViews() {
+  int failures = 0;
+  const std::string frame = "HDR{a: [1 2]}\x01[1] x]TRL";
+  std::string_view first = std::string_view(frame).substr(3, 10);
+  std::string_view second = std::string_view(frame).substr(14, 5);
+  const std::string expected = "{\"a\": [1, 2]}";
+  size_t before = allocations;
+  std::string viewed = jsonrepair(first);
+  size_t count = allocations - before;
+  JSONRepairResult<std::string> failed = jsonrepair(second, std::nothrow);
+  std::u16string wide = u"..[1 2]..";
+  if (viewed != expected || count > 1 ||
+      jsonrepair(std::string_view(frame.data() + 3, first.size())) !=
+          expected ||
+      jsonrepair("{a: [1 2]}") != expected ||
+      jsonrepair("{a: [1 2]}", 10) != expected ||
+      jsonrepair(std::u16string_view(wide).substr(2, 5)) != u"[1, 2]" ||
+      failed.error != JSONRepairErrorCode::UnexpectedCharacter ||
+      failed.position != 4 ||
+      !jsonanalyze(first).needs(JSONRepairCategory::MissingComma)) {
+    std::cerr << "view repair gave: " << viewed << " in " << count
+              << " allocations, " << failed.position << "\n";
+    failures++;
+  }
+  // A pointer and a number are text and a depth, as they always were.
+  std::string nested = "[[[1]]]";
+  try {
+    jsonrepair(nested.c_str(), 2);
+    std::cerr << "pointer repair ignored its depth\n";
+    failures++;
+  } catch (const JSONRepairError &e) {
+    if (std::string(e.what()).find("Maximum depth") == std::string::npos) {
+      std::cerr << "pointer repair failed with: " << e.what() << "\n";
+      failures++;
+    }
+  }
+#if defined(__cpp_char8_t)
+  // char8_t text is repaired by the header over the char engine, so it links
+  // against a library built as C++17.
+  std::u8string u8;
+  std::u8string parts;
+  JSONRepairFunctionSink<char8_t> u8sink([&](std::u8string_view part) {
+    parts += part;
+    return true;
+  });
+  JSONRepairEdits<std::u8string> u8edits = jsonedits(u8"[1 2]");
+  if (jsonrepair(u8"{a: '表'}") != u8"{\"a\": \"表\"}" ||
+      !jsonrepair(u8"[1 2]", u8) || u8 != u8"[1, 2]" ||
+      jsonrepair(std::u8string_view(u8"[1,"), std::nothrow).output != u8"[1]" ||
+      !jsonrepair(u8"[True", u8sink) || parts != u8"[true]" ||
+      u8edits.edits.size() != 1 || u8edits.edits[0].text != u8"," ||
+      jsoncomplete(u8"[\"x").suffix != u8"\"]") {
+    std::cerr << "char8_t repair gave: "
+              << std::string(u8.begin(), u8.end()) << "\n";
+    failures++;
+  }
+#endif
+  return failures;
+}
+
+// A sink is given the repair in parts as it is made, each a few kilobytes
+// at most, and the same error.
+static int checkSink() {
+  int failures = 0;
+  std::vector<std::string> parts;
+  JSONRepairFunctionSink<char> collect([&](std::string_view part) {
+    parts.emplace_back(part);
+    return true;
+  });
+  auto joined = [&] {
+    std::string out;
+    for (const std::string &part : parts)
+      out += part;
+    return out;
+  };
+  for (const std::string &v : testdad) {
+    parts.clear();
+    JSONRepairResult<std::string> whole = jsonrepair(v, std::nothrow);
+    JSONRepairStatus status = jsonrepair(v, collect);
+    if (status.error != whole.error || status.position != whole.position ||
+        (whole && joined() != whole.output)) {
+      std::cerr << "sink repair of: " << v << " gave " << joined() << "\n";
+      failures++;
+    }
+  }
+  std::string document =
+      "{items: [\n" +
+      repeat("  {id: 1, 'name': 'item' tags: [1 2], more: \"x\",},\n", 5000) +
+      "  {id: 2, \"name\": \"la";
+  parts.clear();
+  JSONRepairStatus status = jsonrepair(document, collect);
+  size_t largest = 0;
+  for (const std::string &part : parts)
+    largest = std::max(largest, part.size());
+  if (!status || joined() != jsonrepair(document) || parts.size() < 10 ||
+      largest > 8192) {
+    std::cerr << "sink repair in " << parts.size() << " parts of up to "
+              << largest << "\n";
+    failures++;
+  }
+  // Valid JSON goes as it is; a sink that refuses a part stops the repair.
+  parts.clear();
+  jsonrepair(std::string_view("[1, 2]"), collect);
+  char small[16];
+  JSONRepairBufferSink<char> buffer(small, sizeof small);
+  JSONRepairStatus full = jsonrepair(document, buffer);
+  if (parts.size() != 1 || parts[0] != "[1, 2]" ||
+      full.error != JSONRepairErrorCode::WriteFailed || buffer.size() != 0) {
+    std::cerr << "sink wrote " << parts.size() << " parts, then "
+              << full.message << "\n";
+    failures++;
+  }
+  // A second document after a first one the sink has part of cannot be
+  // wrapped in an array with it; while the sink has none, it is.
+  std::string sequence = "[" + repeat("1, ", 3000) + "1]\n[2]";
+  JSONRepairOptions lenient;
+  lenient.lenient = true;
+  JSONRepairStatus strict = jsonrepair(sequence, collect);
+  parts.clear();
+  JSONRepairStatus skipped = jsonrepair(sequence, collect, lenient);
+  if (strict.error != JSONRepairErrorCode::DocumentSequence ||
+      strict.position != sequence.size() - 3 || !skipped ||
+      joined() != sequence.substr(0, sequence.size() - 3)) {
+    std::cerr << "sink repair of a sequence failed at " << strict.position
+              << "\n";
+    failures++;
+  }
+  std::string lines = repeat("{\"a\": 1}\n", 100);
+  parts.clear();
+  status = jsonrepair(lines, collect);
+  if (!status || joined() != jsonrepair(lines)) {
+    std::cerr << "sink repair of short NDJSON gave " << joined() << "\n";
+    failures++;
+  }
+  std::ostringstream stream;
+  JSONRepairOstreamSink streamSink(stream);
+  std::u16string wide;
+  JSONRepairFunctionSink<char16_t> wideSink([&](std::u16string_view part) {
+    wide += part;
+    return true;
+  });
+  if (!jsonrepair("{a: 1}", streamSink) || stream.str() != "{\"a\": 1}" ||
+      !jsonrepair(u"[1 2", wideSink) || wide != u"[1, 2]") {
+    std::cerr << "sink repair to a stream gave: " << stream.str() << "\n";
+    failures++;
+  }
+#if __has_include(<unistd.h>)
+  int fds[2];
+  char piped[16] = {};
+  if (pipe(fds) == 0) {
+    JSONRepairFdSink fdSink(fds[1]);
+    status = jsonrepair("[1 2", fdSink);
+    close(fds[1]);
+    ssize_t count = read(fds[0], piped, sizeof piped - 1);
+    close(fds[0]);
+    if (!status || count != 6 || std::string(piped) != "[1, 2]") {
+      std::cerr << "sink repair to a pipe gave: " << piped << "\n";
+      failures++;
+    }
+  }
+#endif
+  return failures;
+}
+
 int main() {
+  int failures = 0;
   for (auto &v : testdad) {
+    std::string fixed;
     try {
-      std::string fixed = jsonrepair(v, 10);
+      fixed = jsonrepair(v, 10);
       std::cout << fixed << "\n====\n";
     } catch (const JSONRepairError &e) {
       std::cerr << e.what() << "\n====\n";
+      continue;
+    }
+    // The engines only differ in error positions, so compare successful
+    // repairs only.
+    if (repairUtf16(v) != fixed || repairUtf32(v) != fixed) {
+      std::cerr << "encodings disagree on: " << v << "\n====\n";
+      failures++;
     }
   }
-  return 0;
+  // The engines agree past characters of several code units too.
+  for (const std::string &v : nonAsciiInputs(50000)) {
+    std::string utf8 = repairedAs<char>(v);
+    if (repairedAs<char16_t>(v) != utf8 ||
+        repairedAs<char32_t>(v) != utf8) {
+      std::cerr << "encodings disagree on: " << v << "\n====\n";
+      failures++;
+    }
+  }
+  failures += checkLinearStrings();
+  failures += checkLinearEdits();
+  failures += checkPassthrough();
+  failures += checkAllocations();
+  failures += checkDeepNesting();
+  failures += checkBudgets();
+  failures += checkMemoryResource();
+  failures += checkRepairer();
+  failures += checkNoThrow();
+  failures += checkLenient();
+  failures += checkAnalysis();
+  failures += checkStream();
+  failures += checkCompletion();
+  failures += checkEdits();
+  failures += checkInPlace();
+  failures += checkViews();
+  failures += checkSink();
+  return failures == 0 ? 0 : 1;
 }
 
 std::vector<std::string> testdad = {
@@ -30,6 +1126,7 @@ std::vector<std::string> testdad = {
 }
 )",
   R"({ “id”: 1 })",
+  "{\u00a0‘name’:\u2003\"表 5\"\u3000}",
     "{ homepage: https://example.com/path }",
     "\"hello\\world",
     R"({ a: "foo" + "bar", b: "baz" })",
@@ -38,4 +1135,8 @@ std::vector<std::string> testdad = {
 { "id": 3 })",
     R"([[[[[[[[[1]]]]])",
     "+",
+    "`)b \\,“*/",
+    "\n”\"x\"",
+    "[a...e:'+\n\u00a0",
+    "[1,callback(\n”\"k\": ",
 };
\ No newline at end of file